@@ -0,0 +1,122 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+
+/** Binary snapshot of simulation state. The same code saves and restores
+ *  it: each part passes its fields through io(), which writes them to the
+ *  file when saving and reads them back in place when restoring. */
+class Checkpoint
+{
+protected:
+    /** Start of the file. */
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+    };
+    
+    static const uint32_t version = 7;
+    
+    FILE *file;
+    bool saving;
+    bool failed;
+    
+    Checkpoint(FILE *_file, bool _saving) :
+        file(_file),
+        saving(_saving),
+        failed(false)
+    {
+    }
+    
+    static const char *magic() { return "DRAMCKPT"; }
+
+public:
+    virtual ~Checkpoint() {
+        if (file) fclose(file);
+    }
+    
+    /** Start a checkpoint to save into; NULL on error. */
+    static Checkpoint *create(const char *path) {
+        FILE *file = fopen(path, "wb");
+        if (file == NULL) return NULL;
+        
+        Checkpoint *checkpoint = new Checkpoint(file, true);
+        Header header = Header();
+        memcpy(header.magic, magic(), sizeof(header.magic));
+        header.version = version;
+        checkpoint->io(header);
+        
+        return checkpoint;
+    }
+    
+    /** Open a checkpoint to restore from; NULL on error. */
+    static Checkpoint *open(const char *path) {
+        FILE *file = fopen(path, "rb");
+        if (file == NULL) return NULL;
+        
+        Checkpoint *checkpoint = new Checkpoint(file, false);
+        Header header;
+        checkpoint->io(header);
+        if (!checkpoint->is_ok() || memcmp(header.magic, magic(), sizeof(header.magic)) != 0 ||
+            header.version != version) {
+            delete checkpoint;
+            return NULL;
+        }
+        
+        return checkpoint;
+    }
+    
+    /** True if saving, false if restoring. */
+    bool is_saving() {
+        return saving;
+    }
+    
+    /** True if nothing went wrong so far. */
+    bool is_ok() {
+        return !failed;
+    }
+    
+    void io(void *data, size_t size) {
+        if (failed) return;
+        
+        if (saving) {
+            failed = fwrite(data, 1, size, file) != size;
+        } else {
+            failed = fread(data, 1, size, file) != size;
+        }
+    }
+    
+    template<class DataType>
+    void io(DataType &data) {
+        io(&data, sizeof(DataType));
+    }
+    
+    /** Save a value the restoring side must have too, such as a size;
+     *  restoring fails if it differs. */
+    template<class DataType>
+    void expect(DataType value) {
+        DataType saved = value;
+        io(saved);
+        if (saved != value) failed = true;
+    }
+    
+    /** Check a restored value, such as an index, before it is used;
+     *  restoring fails if it is invalid. False if anything went wrong. */
+    bool check(bool is_valid) {
+        if (!is_valid) failed = true;
+        return !failed;
+    }
+    
+    /** Finish the checkpoint; false if anything went wrong. */
+    bool close() {
+        if (file && fclose(file) != 0) failed = true;
+        file = NULL;
+        
+        return !failed;
+    }
+};
+
+#endif
@@ -1,6 +1,8 @@
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
 #include <iostream>
+#include <stdint.h>
 
 template<class DataType>
 class Container
@@ -107,6 +109,401 @@ public:
         
         return data;
     }
+    
+    /** Save or restore through archive, whose item() takes each element. */
+    template<class Archive>
+    void checkpoint(Archive &archive) {
+        archive.expect(this->m_size);
+        archive.io(this->m_length);
+        archive.io(this->m_cursor);
+        if (!archive.check(this->m_length <= this->m_size && this->m_cursor < this->m_size)) return;
+        
+        for (size_t i=0; i<this->m_length; ++i) {
+            archive.item((*this)[i]);
+        }
+    }
+};
+
+template<class DataType>
+class Pool : public Container<DataType>
+{
+protected:
+    DataType **m_free; // the first size-length entries are free
+
+public:
+    Pool(int size) : Container<DataType>(size) {
+        this->m_free = new DataType*[size];
+        for (int i=0; i<size; ++i) {
+            this->m_free[i] = &(this->m_data[size-1-i]);
+        }
+    }
+    
+    virtual ~Pool() {
+        delete [] this->m_free;
+    }
+    
+    DataType &push() {
+        assert(this->m_length < this->m_size);
+        
+        this->m_length += 1;
+        
+        return *(this->m_free[this->m_size-this->m_length]);
+    }
+    
+    void remove(DataType &data) {
+        assert(this->m_length > 0);
+        
+        this->m_free[this->m_size-this->m_length] = &data;
+        this->m_length -= 1;
+    }
+    
+    DataType &operator [](int index) {
+        assert(index >= 0 && index < (int)this->m_size);
+        
+        return this->m_data[index];
+    }
+    
+    /** Save or restore through archive, whose item() takes each element
+     *  and each free pointer. */
+    template<class Archive>
+    void checkpoint(Archive &archive) {
+        archive.expect(this->m_size);
+        archive.io(this->m_length);
+        if (!archive.check(this->m_length <= this->m_size)) return;
+        
+        for (size_t i=0; i<this->m_size; ++i) {
+            archive.item(this->m_data[i]);
+            archive.item(this->m_free[i]);
+        }
+        for (size_t i=0; i<this->m_size-this->m_length; ++i) {
+            if (!archive.check(this->m_free[i] != NULL)) return;
+        }
+    }
+};
+
+/** Calendar queue of items keyed by time, popped once their time comes.
+ *  Items due within a window of slots after the earliest pending time go
+ *  straight into the slot of their time, the rest wait in an overflow list
+ *  until the window reaches them. Occupied slots are found by bitmask, so
+ *  each pop only touches due items. */
+template<class DataType>
+class TimingWheel : public Container<DataType>
+{
+protected:
+    int64_t *m_time;
+    int *m_link; // next item in the same slot or list, or free
+    int m_free;
+    
+    size_t m_slots; // a power of 2, and a multiple of 64
+    int *m_head;
+    int *m_tail;
+    uint64_t *m_occupied; // one bit per slot
+    
+    int m_overflow;
+    int m_overflowTail;
+    int64_t m_overflowTime; // earliest time in the overflow list
+    
+    int64_t m_base; // the earliest time not popped yet
+    
+    void append(int *head, int *tail, int item) {
+        this->m_link[item] = -1;
+        if (*head == -1) {
+            *head = item;
+        } else {
+            this->m_link[*tail] = item;
+        }
+        *tail = item;
+    }
+    
+    void schedule(int item) {
+        size_t slot = this->m_time[item] & (this->m_slots-1);
+        
+        append(&this->m_head[slot], &this->m_tail[slot], item);
+        this->m_occupied[slot/64] |= (uint64_t)1 << slot%64;
+    }
+    
+    /** Slots from the base one to the first occupied one, m_slots if none. */
+    size_t distance() {
+        size_t base = this->m_base & (this->m_slots-1);
+        size_t words = this->m_slots/64;
+        
+        for (size_t i=0; i<=words; ++i) {
+            size_t word = (base/64 + i) % words;
+            uint64_t bits = this->m_occupied[word];
+            if (i == 0) bits &= ~(uint64_t)0 << base%64;
+            if (bits) {
+                size_t slot = word*64 + __builtin_ctzll(bits);
+                return (slot - base) & (this->m_slots-1);
+            }
+        }
+        
+        return this->m_slots;
+    }
+    
+    /** True if a restored link is an item or -1. */
+    bool is_link(int item) {
+        return item >= -1 && item < (int)this->m_size;
+    }
+    
+    /** Move overflow items that are now within the window into slots. */
+    void migrate() {
+        if (this->m_overflowTime >= this->m_base + (int64_t)this->m_slots) return;
+        
+        int item = this->m_overflow;
+        this->m_overflow = -1;
+        this->m_overflowTime = INT64_MAX;
+        while (item != -1) {
+            int next = this->m_link[item];
+            if (this->m_time[item] < this->m_base + (int64_t)this->m_slots) {
+                schedule(item);
+            } else {
+                append(&this->m_overflow, &this->m_overflowTail, item);
+                this->m_overflowTime = std::min(this->m_overflowTime, this->m_time[item]);
+            }
+            item = next;
+        }
+    }
+
+public:
+    TimingWheel(int size, int slots) : Container<DataType>(size) {
+        assert(slots >= 64 && (slots & (slots-1)) == 0);
+        
+        this->m_time = new int64_t[size];
+        this->m_link = new int[size];
+        for (int i=0; i<size; ++i) {
+            this->m_link[i] = i+1 < size ? i+1 : -1;
+        }
+        this->m_free = 0;
+        
+        this->m_slots = slots;
+        this->m_head = new int[slots];
+        this->m_tail = new int[slots];
+        for (int i=0; i<slots; ++i) {
+            this->m_head[i] = -1;
+        }
+        this->m_occupied = new uint64_t[slots/64]();
+        
+        this->m_overflow = -1;
+        this->m_overflowTail = -1;
+        this->m_overflowTime = INT64_MAX;
+        
+        this->m_base = 0;
+    }
+    
+    virtual ~TimingWheel() {
+        delete [] this->m_time;
+        delete [] this->m_link;
+        delete [] this->m_head;
+        delete [] this->m_tail;
+        delete [] this->m_occupied;
+    }
+    
+    /** Add data due at time; items already due are popped next. */
+    void push(int64_t time, const DataType &data) {
+        assert(this->m_length < this->m_size);
+        
+        int item = this->m_free;
+        this->m_free = this->m_link[item];
+        this->m_length += 1;
+        
+        this->m_data[item] = data;
+        this->m_time[item] = std::max(time, this->m_base);
+        
+        if (this->m_time[item] < this->m_base + (int64_t)this->m_slots) {
+            schedule(item);
+        } else {
+            append(&this->m_overflow, &this->m_overflowTail, item);
+            this->m_overflowTime = std::min(this->m_overflowTime, this->m_time[item]);
+        }
+    }
+    
+    /** Take the earliest item due by clock, in time order, and in order
+     *  of push for the same time; false if none is due. */
+    bool pop(int64_t clock, DataType &data) {
+        while (true) {
+            size_t slot = this->m_base & (this->m_slots-1);
+            
+            int item = this->m_head[slot];
+            if (item != -1 && this->m_base <= clock) {
+                this->m_head[slot] = this->m_link[item];
+                if (this->m_head[slot] == -1) {
+                    this->m_occupied[slot/64] &= ~((uint64_t)1 << slot%64);
+                }
+                
+                data = this->m_data[item];
+                this->m_link[item] = this->m_free;
+                this->m_free = item;
+                this->m_length -= 1;
+                
+                return true;
+            }
+            
+            // skip to the next occupied slot, but not past clock
+            int64_t base = this->m_base + distance();
+            base = std::min(base, this->m_overflowTime);
+            if (base > clock) {
+                this->m_base = std::max(this->m_base, clock);
+                migrate();
+                
+                return false;
+            }
+            this->m_base = base;
+            migrate();
+        }
+    }
+    
+    /** The earliest time of any item, INT64_MAX if there is none. */
+    int64_t next() {
+        if (this->m_length == 0) return INT64_MAX;
+        
+        size_t distance = this->distance();
+        if (distance == this->m_slots) return this->m_overflowTime;
+        
+        return std::min(this->m_base + (int64_t)distance, this->m_overflowTime);
+    }
+    
+    /** Save or restore through archive, whose item() takes each element. */
+    template<class Archive>
+    void checkpoint(Archive &archive) {
+        archive.expect(this->m_size);
+        archive.expect(this->m_slots);
+        archive.io(this->m_length);
+        
+        archive.io(this->m_time, this->m_size*sizeof(int64_t));
+        archive.io(this->m_link, this->m_size*sizeof(int));
+        archive.io(this->m_free);
+        archive.io(this->m_head, this->m_slots*sizeof(int));
+        archive.io(this->m_tail, this->m_slots*sizeof(int));
+        archive.io(this->m_occupied, this->m_slots/64*sizeof(uint64_t));
+        archive.io(this->m_overflow);
+        archive.io(this->m_overflowTail);
+        archive.io(this->m_overflowTime);
+        archive.io(this->m_base);
+        
+        // every link is an item or -1, so lists can be walked safely
+        bool is_valid = this->m_length <= this->m_size && is_link(this->m_free) &&
+            is_link(this->m_overflow) && is_link(this->m_overflowTail);
+        for (size_t i=0; i<this->m_size; ++i) is_valid = is_valid && is_link(this->m_link[i]);
+        for (size_t i=0; i<this->m_slots; ++i) {
+            is_valid = is_valid && is_link(this->m_head[i]) && is_link(this->m_tail[i]);
+        }
+        if (!archive.check(is_valid)) return;
+        
+        // only the items off the free list hold data; a cycle would revisit one
+        bool *is_free = new bool[this->m_size]();
+        for (int item = this->m_free; item != -1 && is_valid; item = this->m_link[item]) {
+            is_valid = !is_free[item];
+            is_free[item] = true;
+        }
+        if (archive.check(is_valid)) {
+            for (size_t i=0; i<this->m_size; ++i) {
+                if (!is_free[i]) archive.item(this->m_data[i]);
+            }
+        }
+        delete [] is_free;
+    }
+};
+
+/** Slots taken in order, so that slot order is age order. Once the last
+ *  slot is taken, compact() moves the live slots down to make room. */
+template<class DataType>
+class SlotPool : public Container<DataType>
+{
+protected:
+    size_t m_slots; // at least twice the size, so compact() is rare
+    size_t m_words;
+    size_t m_next; // slot of the next push
+    uint64_t *m_occupied; // one bit per slot
+
+public:
+    SlotPool(int size) : Container<DataType>(size) {
+        this->m_slots = (2*size+63)/64*64;
+        this->m_words = this->m_slots/64;
+        this->m_next  = 0;
+        
+        delete [] this->m_data;
+        this->m_data = new DataType[this->m_slots];
+        this->m_occupied = new uint64_t[this->m_words]();
+    }
+    
+    virtual ~SlotPool() {
+        delete [] this->m_occupied;
+    }
+    
+    DataType &operator [](int index) {
+        assert(index >= 0 && index < (int)this->m_slots);
+        
+        return this->m_data[index];
+    }
+    
+    /** Words in a bitmask with one bit per slot. */
+    size_t words() {
+        return this->m_words;
+    }
+    
+    const uint64_t *occupied() {
+        return this->m_occupied;
+    }
+    
+    int index(DataType &data) {
+        return &data - this->m_data;
+    }
+    
+    /** True if push() has to wait for compact(). */
+    const bool is_spread() {
+        return this->m_next == this->m_slots;
+    }
+    
+    DataType &push() {
+        assert(this->m_length < this->m_size && !is_spread());
+        
+        int index = this->m_next++;
+        this->m_occupied[index/64] |= (uint64_t)1 << index%64;
+        this->m_length += 1;
+        
+        return this->m_data[index];
+    }
+    
+    void remove(DataType &data) {
+        int index = this->index(data);
+        assert(this->m_occupied[index/64] & ((uint64_t)1 << index%64));
+        
+        this->m_occupied[index/64] &= ~((uint64_t)1 << index%64);
+        this->m_length -= 1;
+    }
+    
+    /** Move the live slots down, in order; this changes their indices. */
+    void compact() {
+        size_t next = 0;
+        
+        for (size_t i=0; i<this->m_words; ++i) {
+            for (uint64_t bits = this->m_occupied[i]; bits; bits &= bits - 1) {
+                this->m_data[next++] = this->m_data[i*64 + __builtin_ctzll(bits)];
+            }
+            this->m_occupied[i] = 0;
+        }
+        for (size_t i=0; i<next; ++i) {
+            this->m_occupied[i/64] |= (uint64_t)1 << i%64;
+        }
+        
+        this->m_next = next;
+    }
+    
+    /** Save or restore through archive, whose item() takes each element. */
+    template<class Archive>
+    void checkpoint(Archive &archive) {
+        archive.expect(this->m_slots);
+        archive.io(this->m_length);
+        archive.io(this->m_next);
+        archive.io(this->m_occupied, this->m_words*sizeof(uint64_t));
+        if (!archive.check(this->m_length <= this->m_size && this->m_next <= this->m_slots)) return;
+        
+        for (size_t i=0; i<this->m_words; ++i) {
+            for (uint64_t bits = this->m_occupied[i]; bits; bits &= bits - 1) {
+                archive.item(this->m_data[i*64 + __builtin_ctzll(bits)]);
+            }
+        }
+    }
 };
 
 template<class DataType>
@@ -1,13 +1,35 @@
 #include "dram.h"
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <sched.h>
+#if defined(__AVX2__) || defined(__BMI2__)
+#include <immintrin.h>
+#endif
 
 using namespace DRAM;
 
+/** The lowest bits of field number source, at most as many as target has;
+ *  zero wide if source is 0. */
+static BitField hashBits(BitField *fields[], int source, const BitField &target)
+{
+    BitField hash = {0, 0};
+    if (source == 0) return hash;
+    
+    assert(source >= 1 && source <= 5 && fields[source] != &target);
+    hash.offset = fields[source]->offset;
+    hash.width  = std::min(fields[source]->width, target.width);
+    
+    return hash;
+}
+
 Config::Config(std::map<std::string, int> config)
 {
 #define _(key) config[#key]
 
     nRequest     = _(request);
     nTransaction = _(transaction);
+    nWrite       = _(write);
     nCommand     = _(command);
     
     nDevice  = _(device);
@@ -17,195 +39,1656 @@ Config::Config(std::map<std::string, int> config)
     nBank    = 1 << _(bank);
     nRow     = 1 << _(row);
     nColumn  = 1 << _(column);
+    nSource  = _(source);
+    assert(nSource >= 1);
+    
+    // fields from the lowest address bits up, one digit each
+    BitField *fields[] = {NULL, &mapping.channel, &mapping.column, &mapping.rank, &mapping.bank, &mapping.row};
+    const int widths[] = {0, _(channel), _(column), _(rank), _(bank), _(row)};
+    
+    char order[16];
+    snprintf(order, sizeof(order), "%d", _(mapping));
+    assert(strlen(order) == 5);
     
     uint8_t offset = _(line);
-    mapping.channel.offset = offset; offset +=
-    mapping.channel.width  = _(channel);
-    mapping.column.offset  = offset; offset +=
-    mapping.column.width   = _(column);
-    mapping.rank.offset    = offset; offset +=
-    mapping.rank.width     = _(rank);   
-    mapping.bank.offset    = offset; offset +=
-    mapping.bank.width     = _(bank);
-    mapping.row.offset     = offset; offset +=
-    mapping.row.width      = _(row);
+    unsigned seen = 0;
+    for (const char *p = order; *p; ++p) {
+        int field = *p - '0';
+        assert(field >= 1 && field <= 5 && !(seen & (1 << field)));
+        seen |= 1 << field;
+        
+        fields[field]->offset = offset;
+        fields[field]->width  = widths[field];
+        offset += widths[field];
+    }
+    assert(offset <= 64);
+    
+    mapping.channelHash = hashBits(fields, _(channel_xor), mapping.channel);
+    mapping.bankHash    = hashBits(fields, _(bank_xor), mapping.bank);
     
+    // padding and all, as presets compare it whole
+    memset(&policy, 0, sizeof(policy));
     policy.max_row_idle = _(max_row_idle);
     policy.max_row_hits = _(max_row_hits);
+    policy.page_policy  = _(page_policy);
+    assert(policy.page_policy <= PAGE_adaptive);
+    policy.write_high   = _(write_high);
+    policy.write_low    = _(write_low);
+    assert(policy.write_high == 0 || policy.write_low < policy.write_high);
+    // a higher watermark than the writes fit could never be reached
+    assert(policy.write_high <= (nWrite > 0 ? nWrite : nTransaction));
+    policy.refresh_postpone = _(refresh_postpone);
+    policy.refresh_pullin   = _(refresh_pullin);
+    policy.refresh_per_bank = _(refresh_per_bank);
+    assert(policy.refresh_postpone <= 8 && policy.refresh_pullin <= 8);
+    policy.powerdown_active = _(powerdown_active);
+    policy.powerdown_idle   = _(powerdown_idle);
+    policy.selfrefresh_idle = _(selfrefresh_idle);
     
-    timing.transaction_delay = _(tTQ);
-    timing.command_delay     = _(tCQ);
-    
-    timing.channel.any_to_any     = _(tCMD);
-    timing.channel.act_to_any     = _(tRCMD);
-    timing.channel.read_to_read   = _(tBL)+_(tRTRS);
-    timing.channel.read_to_write  = _(tCL)+_(tBL)+_(tRTRS)-_(tCWL);
-    timing.channel.write_to_read  = _(tCWL)+_(tBL)+_(tRTRS)-_(tCL);
-    timing.channel.write_to_write = _(tBL)+_(tRTRS);
-    
-    timing.rank.act_to_act     = _(tRRD);
-    timing.rank.act_to_faw     = _(tFAW);
-    timing.rank.read_to_read   = std::max(_(tBL), _(tCCD));
-    timing.rank.read_to_write  = _(tCL)+_(tBL)+_(tRTRS)-_(tCWL); // double check
-    timing.rank.write_to_read  = _(tCWL)+_(tBL)+_(tWTR); // double check
-    timing.rank.write_to_write = std::max(_(tBL), _(tCCD));
-    
-    timing.rank.refresh_latency  = _(tRFC);
-    timing.rank.refresh_interval = _(tREFI);
-    
-    timing.rank.powerdown_latency = _(tCKE); // double check
-    timing.rank.powerup_latency   = _(tXP); // double check
-    
-    timing.bank.act_to_read   = _(tRCD)-_(tAL) + _(tRCMD)-_(tCMD);
-    timing.bank.act_to_write  = _(tRCD)-_(tAL) + _(tRCMD)-_(tCMD);
-    timing.bank.act_to_pre    = _(tRAS) + _(tRCMD)-_(tCMD);
-    timing.bank.read_to_pre   = _(tAL)+_(tBL)+std::max(_(tRTP), _(tCCD))-_(tCCD); // double check
-    timing.bank.write_to_pre  = _(tAL)+_(tCWL)+_(tBL)+_(tWR); // double check
-    timing.bank.pre_to_act    = _(tRP);
-    timing.bank.read_to_data  = _(tAL)+_(tCL) + 5;
-    timing.bank.write_to_data = _(tAL)+_(tCWL) + 5;
+    scheduling.type               = (SchedulerType)_(scheduler);
+    scheduling.marking_cap        = _(marking_cap);
+    scheduling.quantum            = _(quantum);
+    scheduling.blacklist_streak   = _(blacklist_streak);
+    scheduling.blacklist_interval = _(blacklist_interval);
+    assert(scheduling.quantum > 0 && scheduling.blacklist_interval > 0);
+    
+    TimingParameters parameters = {
+        _(tTQ), _(tCQ), _(tCMD), _(tRCMD),
+        _(tCL), _(tCWL), _(tAL), _(tBL),
+        _(tRAS), _(tRCD), _(tRRD), _(tRP),
+        _(tCCD), _(tRTP), _(tWTR), _(tWR), _(tRTRS),
+        _(tRFC), _(tREFI), _(tFAW), _(tCKE), _(tXP),
+        _(tRFCpb), _(tCKESR), _(tXS),
+    };
+    timing = deriveTiming(parameters);
     
     energy.act     = (((_(IDD0)-_(IDD3N))*_(tRAS))+((_(IDD0)-_(IDD2N))*_(tRP)))*nDevice;
     energy.read    = (_(IDD4R)-_(IDD3N))*_(tBL)*nDevice;
     energy.write   = (_(IDD4W)-_(IDD3N))*_(tBL)*nDevice;
     energy.refresh = (_(IDD5)-_(IDD3N))*_(tRFC)*nDevice;
+    // the same charge over a tREFI, in nBank parts
+    energy.refresh_bank = energy.refresh/nBank;
     
     energy.powerup_per_cycle   = _(IDD3N);
-    energy.powerdown_per_cycle = _(IDD2Q);
+    energy.powerdown_per_cycle = _(IDD2P);
+    energy.active_powerdown_per_cycle = _(IDD3Pf);
+    energy.selfrefresh_per_cycle      = _(IDD6);
+    
+    // bus and clock energy are not modeled yet
+    energy.clock_per_cycle = 0;
+    energy.command_bus     = 0;
+    energy.row_address_bus = 0;
+    energy.col_address_bus = 0;
+    energy.data_bus        = 0;
 
 #undef _
 }
 
+/** Fold a ready time into the earliest one still to come after clock. */
+static inline int64_t earliest(int64_t next, int64_t readyTime, int64_t clock)
+{
+    return readyTime > clock ? std::min(next, readyTime) : next;
+}
+
 
 
 /*static const int bins = 128;
 static int hist[bins];
 static int read_count, write_count;
 */
-MemoryControllerHub::MemoryControllerHub(Config *_config) :
+MemoryControllerHub::MemoryControllerHub(Config *_config, bool specialize) :
     config(_config)
 {
-    controllers = new MemoryController*[config->nChannel];
+    controllers = new Controller*[config->nChannel];
     for (uint32_t i=0; i<config->nChannel; ++i) {
-        controllers[i] = new MemoryController(config);
+        controllers[i] = Controller::create(config, specialize);
+    }
+}
+
+MemoryControllerHub::~MemoryControllerHub()
+{
+    for (uint32_t i=0; i<config->nChannel; ++i) {
+        delete controllers[i];
+    }
+    delete [] controllers;
+
+    /*std::cerr << "---\n";
+    for(int i=0; i<bins; ++i) {
+        std::cerr << hist[i] << "\n";
+    }*/
+}
+
+bool MemoryControllerHub::addRequest(int64_t clock, uint64_t address, bool is_write, uint64_t id,
+    uint16_t source)
+{
+    AddressMapping &mapping = config->mapping;
+    
+    int channel = mapping.channelOf(address);
+    
+    return controllers[channel]->addRequest(clock, address, is_write, id, source);
+}
+
+/** Address fields of one request. */
+static inline void decode(AddressMapping &mapping, uint64_t address, Coordinates &coordinates)
+{
+    coordinates.channel = mapping.channelOf(address);
+    coordinates.rank    = mapping.rank.value(address);
+    coordinates.bank    = mapping.bankOf(address);
+    coordinates.row     = mapping.row.value(address);
+    coordinates.column  = mapping.column.value(address);
+}
+
+/** Address fields of a batch of requests, in one pass. */
+static void decode(AddressMapping &mapping, const Submission *requests, size_t count, Coordinates *coordinates)
+{
+#ifdef __BMI2__
+    // pext gathers the bits under a mask, whatever their layout
+    const uint64_t channelMask = mapping.channel.mask(), rankMask = mapping.rank.mask(),
+        bankMask = mapping.bank.mask(), rowMask = mapping.row.mask(), columnMask = mapping.column.mask();
+    const uint64_t channelHashMask = mapping.channelHash.mask(), bankHashMask = mapping.bankHash.mask();
+    
+    for (size_t i=0; i<count; ++i) {
+        uint64_t address = requests[i].address;
+        coordinates[i].channel = _pext_u64(address, channelMask) ^ _pext_u64(address, channelHashMask);
+        coordinates[i].rank    = _pext_u64(address, rankMask);
+        coordinates[i].bank    = _pext_u64(address, bankMask) ^ _pext_u64(address, bankHashMask);
+        coordinates[i].row     = _pext_u64(address, rowMask);
+        coordinates[i].column  = _pext_u64(address, columnMask);
+    }
+#else
+    for (size_t i=0; i<count; ++i) {
+        decode(mapping, requests[i].address, coordinates[i]);
+    }
+#endif
+}
+
+size_t MemoryControllerHub::addRequests(int64_t clock, const Submission *requests, size_t count, uint32_t *accepted,
+    bool in_order)
+{
+    uint32_t nChannel = config->nChannel;
+    
+    if (in_order) {
+        // cut the batch at the first request its channel has no room for
+        rooms.resize(nChannel);
+        for (uint32_t channel=0; channel<nChannel; ++channel) {
+            rooms[channel] = controllers[channel]->getRoom();
+        }
+        for (size_t i=0; i<count; ++i) {
+            int channel = config->mapping.channelOf(requests[i].address);
+            if (rooms[channel] == 0) {
+                count = i;
+                break;
+            }
+            rooms[channel] -= 1;
+        }
+        if (count == 0) {
+            if (accepted) std::fill(accepted, accepted + nChannel, 0);
+            return 0;
+        }
+    }
+    
+    decoded.resize(count);
+    order.resize(count);
+    starts.assign(nChannel+1, 0);
+    
+    decode(config->mapping, requests, count, decoded.data());
+    
+    // split by channel, keeping the order within each
+    for (size_t i=0; i<count; ++i) {
+        starts[decoded[i].channel+1] += 1;
+    }
+    for (uint32_t channel=0; channel<nChannel; ++channel) {
+        starts[channel+1] += starts[channel];
+    }
+    for (size_t i=0; i<count; ++i) {
+        order[starts[decoded[i].channel]++] = i;
+    }
+    
+    // starts now holds the ends
+    size_t total = 0;
+    for (uint32_t channel=0, start=0; channel<nChannel; start=starts[channel++]) {
+        size_t added = 0;
+        if (starts[channel] > start) {
+            added = controllers[channel]->addRequests(clock, requests, &decoded[0],
+                &order[start], starts[channel] - start);
+        }
+        if (accepted) accepted[channel] = added;
+        total += added;
+    }
+    
+    return total;
+}
+
+bool RequestSource::fetchMore(int64_t &horizon)
+{
+    Submission request;
+    int64_t time;
+    if (!fetch(request, time, horizon)) return false;
+    
+    requests.push_back(request);
+    times.push_back(time);
+    
+    return true;
+}
+
+const Submission *RequestSource::front(int64_t &time)
+{
+    if (requests.empty() && !fetchMore(time)) return NULL;
+    
+    time = times[0];
+    return &requests[0];
+}
+
+size_t RequestSource::peek(int64_t clock, size_t count, const Submission *&requests, int64_t &time)
+{
+    // those due before stay due, the clock only moves on
+    while (due < count) {
+        if (due == this->requests.size() && !fetchMore(time)) break;
+        if (times[due] > clock) {
+            time = times[due];
+            break;
+        }
+        due += 1;
+    }
+    
+    requests = this->requests.data();
+    return std::min(due, count);
+}
+
+void RequestSource::pop(size_t count)
+{
+    requests.erase(requests.begin(), requests.begin() + count);
+    times.erase(times.begin(), times.begin() + count);
+    due -= std::min(due, count);
+}
+
+void MemoryControllerHub::cycle(int64_t clock)
+{
+    for (uint8_t channel=0; channel<config->nChannel; ++channel) {
+        controllers[channel]->cycle(clock);
+    }
+    
+    /*if ((clock+1) % 4000 == 0) {
+        std::cerr << read_count << "\t" << write_count << "\n";
+        read_count = write_count = 0;
+    }*/
+}
+
+int64_t MemoryControllerHub::drive(RequestSource &source, int64_t clock, int64_t until, bool event_driven, bool drain)
+{
+    const size_t batch = 64;
+    
+    int64_t last_clock = clock - 1;
+    while (clock < until) {
+        // how far to run without a request: up to its time or the horizon
+        int64_t time;
+        const Submission *requests;
+        size_t count = source.peek(clock, batch, requests, time);
+        bool draining = false;
+        if (count > 0) {
+            size_t added = count > 1 ? addRequests(clock, requests, count, NULL, true) :
+                addRequest(clock, requests->address, requests->is_write, requests->id, requests->source);
+            source.pop(added);
+            if (added == count) continue;
+            // the first one rejected is retried on the next cycle
+            time = clock;
+        } else if (time == INT64_MAX) {
+            if (!drain || is_idle()) break;
+            draining = true;
+        } else if (clock >= time) {
+            // wait for the source to promise more
+            sched_yield();
+            continue;
+        }
+        int64_t next = std::min(time, until);
+        
+        cycle(clock);
+        last_clock = clock;
+        if (event_driven && clock < next && !(draining && is_idle())) {
+            clock = std::min(getNextEventTime(clock), next);
+        } else {
+            clock += 1;
+        }
+        source.reach(clock);
+    }
+    
+    // cycles skipped at the end are idle, run the last one so that energy covers them
+    if (event_driven && last_clock < clock - 1) {
+        cycle(clock - 1);
+    }
+    
+    return clock;
+}
+
+int64_t MemoryControllerHub::getNextEventTime(int64_t clock)
+{
+    int64_t next = INT64_MAX;
+    
+    for (uint8_t channel=0; channel<config->nChannel; ++channel) {
+        next = std::min(next, controllers[channel]->getNextEventTime(clock));
+    }
+    
+    return next;
+}
+
+void MemoryControllerHub::getStatistics(Statistics &stats)
+{
+    for (uint8_t channel=0; channel<config->nChannel; ++channel) {
+        controllers[channel]->getStatistics(stats);
+    }
+}
+
+void MemoryControllerHub::setListener(Listener *listener)
+{
+    for (uint8_t channel=0; channel<config->nChannel; ++channel) {
+        controllers[channel]->setListener(listener);
+    }
+}
+
+int64_t MemoryControllerHub::getLookahead()
+{
+    Timing &timing = config->timing;
+    
+    return timing.command_delay + std::min(timing.bank.read_to_data, timing.bank.write_to_data);
+}
+
+bool MemoryControllerHub::is_idle()
+{
+    for (uint8_t channel=0; channel<config->nChannel; ++channel) {
+        if (!controllers[channel]->is_idle()) return false;
+    }
+    
+    return true;
+}
+
+void MemoryControllerHub::warm(int64_t clock, uint64_t address)
+{
+    AddressMapping &mapping = config->mapping;
+    
+    int channel = mapping.channelOf(address);
+    
+    controllers[channel]->warm(clock, address);
+}
+
+void MemoryControllerHub::warm(int64_t clock)
+{
+    for (uint8_t channel=0; channel<config->nChannel; ++channel) {
+        controllers[channel]->warm(clock);
+    }
+}
+
+void MemoryControllerHub::enableCompletions(size_t size, bool early)
+{
+    for (uint8_t channel=0; channel<config->nChannel; ++channel) {
+        controllers[channel]->enableCompletions(size, early);
+    }
+}
+
+size_t MemoryControllerHub::pollCompletions(Completion *completions, size_t count)
+{
+    size_t polled = 0;
+    
+    for (uint8_t channel=0; channel<config->nChannel && polled<count; ++channel) {
+        polled += controllers[channel]->pollCompletions(completions + polled, count - polled);
+    }
+    
+    return polled;
+}
+
+bool MemoryControllerHub::checkpoint(Checkpoint &checkpoint)
+{
+    checkpoint.expect(config->nChannel);
+    checkpoint.expect(config->nRank);
+    checkpoint.expect(config->nBank);
+    checkpoint.expect(config->nRequest);
+    checkpoint.expect(config->nTransaction);
+    checkpoint.expect(config->nWrite);
+    checkpoint.expect(config->nSource);
+    checkpoint.expect(config->scheduling.type);
+    checkpoint.expect(config->nCommand);
+    if (!checkpoint.is_ok()) return false;
+    
+    for (uint8_t channel=0; channel<config->nChannel; ++channel) {
+        controllers[channel]->checkpoint(checkpoint);
+    }
+    
+    return checkpoint.is_ok();
+}
+
+ParallelMemoryControllerHub::ParallelMemoryControllerHub(Config *_config, int nThread, bool specialize) :
+    MemoryControllerHub(_config, specialize),
+    pool(std::min(nThread, (int)_config->nChannel))
+{
+}
+
+ParallelMemoryControllerHub::~ParallelMemoryControllerHub()
+{
+}
+
+bool ParallelMemoryControllerHub::stageRequest(int64_t clock, uint64_t address, bool is_write, uint64_t id,
+    uint16_t source)
+{
+    AddressMapping &mapping = config->mapping;
+    
+    int channel = mapping.channelOf(address);
+    
+    return controllers[channel]->stageRequest(clock, address, is_write, id, source);
+}
+
+void ParallelMemoryControllerHub::run(int64_t from, int64_t to, bool event_driven)
+{
+    pool.run(config->nChannel, [&](int channel) {
+        controllers[channel]->run(from, to, event_driven);
+    });
+}
+
+AsyncMemoryControllerHub::AsyncMemoryControllerHub(MemoryControllerHub *_hub, size_t size, bool _event_driven,
+    int64_t _max_clock, bool _drain) :
+    hub(_hub),
+    event_driven(_event_driven),
+    drain(_drain),
+    max_clock(_max_clock),
+    horizon(0),
+    closed(0),
+    progress(0),
+    finalClock(0)
+{
+    lookahead = hub->getLookahead();
+    
+    int error = posix_memalign(&requestMemory, 64, Ring<Request>::bytes(size));
+    assert(error == 0); (void)error;
+    requests = new Ring<Request>(requestMemory, size, true);
+    
+    hub->enableCompletions(size, true);
+    
+    thread = std::thread(&AsyncMemoryControllerHub::simulate, this);
+}
+
+AsyncMemoryControllerHub::~AsyncMemoryControllerHub()
+{
+    close();
+    finish();
+    
+    delete requests;
+    free(requestMemory);
+}
+
+bool AsyncMemoryControllerHub::HostSource::fetch(Submission &request, int64_t &time, int64_t &horizon)
+{
+    // the promises go first, whatever was added before them is in the ring
+    bool is_closed = hub->closed.load(std::memory_order_acquire);
+    int64_t promised = hub->horizon.load(std::memory_order_acquire);
+    
+    Request pushed;
+    if (!hub->requests->pop(pushed)) {
+        horizon = is_closed ? INT64_MAX : promised;
+        return false;
+    }
+    
+    request.id = pushed.id;
+    request.address = pushed.address;
+    request.is_write = pushed.is_write;
+    request.source = pushed.source;
+    time = pushed.allocateTime;
+    
+    return true;
+}
+
+void AsyncMemoryControllerHub::HostSource::reach(int64_t clock)
+{
+    hub->progress.store(clock, std::memory_order_release);
+}
+
+void AsyncMemoryControllerHub::simulate()
+{
+    HostSource source(this);
+            
+    finalClock = hub->drive(source, 0, max_clock, event_driven, drain);
+    progress.store(INT64_MAX, std::memory_order_release);
+}
+
+bool AsyncMemoryControllerHub::addRequest(int64_t clock, uint64_t address, bool is_write, uint64_t id,
+    uint16_t source)
+{
+    Request request = Request();
+    
+    request.id = id;
+    request.address = address;
+    request.is_write = is_write;
+    request.source = source;
+    request.allocateTime = clock;
+    
+    if (!requests->push(request)) return false;
+    
+    // in time order, nothing comes before this request
+    setHorizon(clock);
+    
+    return true;
+}
+
+void AsyncMemoryControllerHub::setHorizon(int64_t horizon)
+{
+    if (horizon > this->horizon.load(std::memory_order_relaxed)) {
+        this->horizon.store(horizon, std::memory_order_release);
+    }
+}
+
+void AsyncMemoryControllerHub::close()
+{
+    closed.store(1, std::memory_order_release);
+}
+
+size_t AsyncMemoryControllerHub::pollCompletions(Completion *completions, size_t count)
+{
+    return hub->pollCompletions(completions, count);
+}
+
+void AsyncMemoryControllerHub::sync(int64_t clock)
+{
+    // anything scheduled from progress on is released at progress + lookahead or later
+    while (progress.load(std::memory_order_acquire) <= clock - lookahead) {
+        sched_yield();
+    }
+}
+
+bool AsyncMemoryControllerHub::is_finished()
+{
+    return progress.load(std::memory_order_acquire) == INT64_MAX;
+}
+
+int64_t AsyncMemoryControllerHub::finish()
+{
+    if (thread.joinable()) thread.join();
+    
+    return finalClock;
+}
+
+
+
+LatencyModel::LatencyModel(Config *_config) :
+    config(_config)
+{
+    const Timing &timing = config->timing;
+    uint32_t nRank = config->nChannel*config->nRank;
+    uint32_t refresh_step = timing.rank.refresh_interval/config->nRank;
+    if (config->policy.refresh_per_bank) refresh_step /= config->nBank;
+    
+    actSpacing[0][0] = actSpacing[0][1] = actSpacing[1][0] = actSpacing[1][1] = timing.rank.act_to_act;
+    rankSpacing[0][0] = timing.rank.read_to_read;
+    rankSpacing[0][1] = timing.rank.read_to_write;
+    rankSpacing[1][0] = timing.rank.write_to_read;
+    rankSpacing[1][1] = timing.rank.write_to_write;
+    busSpacing[0][0] = timing.channel.read_to_read;
+    busSpacing[0][1] = timing.channel.read_to_write;
+    busSpacing[1][0] = timing.channel.write_to_read;
+    busSpacing[1][1] = timing.channel.write_to_write;
+    
+    Bank bank = {-1, 0, 0, 0, 0, 2, -1};
+    banks.assign(nRank*config->nBank, bank);
+    
+    Slots slots = Slots();
+    ranks.resize(nRank);
+    for (uint32_t i=0; i<nRank; ++i) {
+        Rank &rank = ranks[i];
+        rank.refreshTime = refresh_step*(i%config->nRank+1);
+        rank.refreshBank = 0;
+        rank.idleTime    = 0;
+        rank.wakeTime    = 0;
+        rank.activates   = slots;
+        rank.accesses    = slots;
+    }
+    
+    Bus bus = {slots, 0};
+    buses.assign(config->nChannel, bus);
+    releases.assign(config->nChannel*config->nRequest, 0);
+    admitTime = 0;
+    
+    stats = Statistics();
+    hitCount      = 0;
+    missCount     = 0;
+    conflictCount = 0;
+    lastClock = 0;
+    
+    listener = NULL;
+}
+
+LatencyModel::~LatencyModel()
+{
+}
+
+/** Earliest clock from clock for a command spaced from the latest ones
+ *  of its kind in slots, which it joins. Controllers reorder requests, so
+ *  it takes the first gap wide enough, before them or in between; once
+ *  slots are all taken, what came before the oldest is unknown, so not
+ *  before that one. */
+int64_t LatencyModel::fit(int64_t clock, bool is_write, Slots &slots, const Spacing &spacing)
+{
+    int i = slots.count == Slots::size ? 1 : 0;
+    for (; i < slots.count; ++i) {
+        // after the one before, and before this one
+        if (i > 0) clock = std::max(clock, slots.time[i-1] + spacing[slots.is_write[i-1]][is_write]);
+        if (clock + spacing[is_write][slots.is_write[i]] <= slots.time[i]) break;
+    }
+    if (i == slots.count && i > 0) {
+        clock = std::max(clock, slots.time[i-1] + spacing[slots.is_write[i-1]][is_write]);
+    }
+    
+    // the oldest one goes once they are all taken
+    if (slots.count == Slots::size) {
+        std::copy(slots.time + 1, slots.time + i, slots.time);
+        std::copy(slots.is_write + 1, slots.is_write + i, slots.is_write);
+        i -= 1;
+    } else {
+        std::copy_backward(slots.time + i, slots.time + slots.count, slots.time + slots.count + 1);
+        std::copy_backward(slots.is_write + i, slots.is_write + slots.count, slots.is_write + slots.count + 1);
+        slots.count += 1;
+    }
+    slots.time[i] = clock;
+    slots.is_write[i] = is_write;
+    
+    return clock;
+}
+
+/** Earliest clock from clock at which a channel has a free buffer, as
+ *  the hub rejects requests until one is. */
+int64_t LatencyModel::admit(int64_t clock, Bus &bus, int64_t *releases)
+{
+    admitTime = std::max(admitTime, clock);
+    
+    if (bus.count == config->nRequest) {
+        std::pop_heap(releases, releases + bus.count, std::greater<int64_t>());
+        bus.count -= 1;
+        admitTime = std::max(admitTime, releases[bus.count]);
+    }
+    
+    return admitTime;
+}
+
+/** Refresh rank for every deadline up to clock, once its banks are done
+ *  and precharged; the rows are closed afterwards. Per bank, each deadline
+ *  refreshes the next bank alone. Refreshes are never postponed or pulled
+ *  in here, and a rank in self-refresh by a deadline refreshes itself. */
+void LatencyModel::refresh(int64_t clock, Rank &rank, Bank *banks)
+{
+    const Timing &timing = config->timing;
+    const Policy &policy = config->policy;
+    
+    if (policy.refresh_per_bank) {
+        while (clock >= rank.refreshTime) {
+            if (policy.selfrefresh_idle > 0 && rank.refreshTime > rank.idleTime + policy.selfrefresh_idle) {
+                rank.refreshTime += timing.rank.refresh_interval/config->nBank;
+                continue;
+            }
+            
+            Bank &bank = banks[rank.refreshBank];
+            int64_t start = std::max(rank.refreshTime, bank.readyTime);
+            if (bank.row != -1) {
+                start = std::max(start, bank.preReadyTime) + timing.bank.pre_to_act;
+                stats.commandCount[COMMAND_precharge] += 1;
+            }
+            
+            bank.row = -1;
+            bank.readyTime = start + timing.rank.refresh_bank_latency;
+            
+            stats.commandCount[COMMAND_refresh_bank] += 1;
+            rank.refreshTime += timing.rank.refresh_interval/config->nBank;
+            rank.refreshBank = (rank.refreshBank + 1) % config->nBank;
+        }
+        return;
+    }
+    
+    while (clock >= rank.refreshTime) {
+        if (policy.selfrefresh_idle > 0 && rank.refreshTime > rank.idleTime + policy.selfrefresh_idle) {
+            rank.refreshTime += timing.rank.refresh_interval;
+            continue;
+        }
+        
+        int64_t start = rank.refreshTime;
+        bool precharge = false;
+        for (uint32_t i=0; i<config->nBank; ++i) {
+            start = std::max(start, banks[i].readyTime);
+            if (banks[i].row != -1) {
+                start = std::max(start, banks[i].preReadyTime);
+                stats.commandCount[COMMAND_precharge] += 1;
+                precharge = true;
+            }
+        }
+        if (precharge) start += timing.bank.pre_to_act;
+        
+        int64_t end = start + timing.rank.refresh_latency;
+        for (uint32_t i=0; i<config->nBank; ++i) {
+            banks[i].row = -1;
+            banks[i].readyTime = end;
+        }
+        rank.idleTime = std::max(rank.idleTime, end);
+        
+        stats.commandCount[COMMAND_refresh] += 1;
+        rank.refreshTime += timing.rank.refresh_interval;
+    }
+}
+
+bool LatencyModel::addRequest(int64_t clock, uint64_t address, bool is_write, uint64_t id,
+    uint16_t source)
+{
+    const Timing &timing = config->timing;
+    const Policy &policy = config->policy;
+    
+    Coordinates coordinates;
+    decode(config->mapping, address, coordinates);
+    
+    uint32_t index = coordinates.channel*config->nRank + coordinates.rank;
+    Rank &rank = ranks[index];
+    Bank *rankBanks = &banks[index*config->nBank];
+    Bank &bank = rankBanks[coordinates.bank];
+    Bus &bus = buses[coordinates.channel];
+    
+    int64_t *flights = &releases[coordinates.channel*config->nRequest];
+    clock = admit(clock, bus, flights);
+    
+    int64_t time = clock + timing.transaction_delay + timing.command_delay;
+    
+    refresh(time, rank, rankBanks);
+    
+    int64_t start = std::max(time, bank.readyTime);
+    
+    // every access trains the page predictor, as none is known to be queued
+    bool is_adaptive = policy.page_policy == PAGE_adaptive;
+    if (is_adaptive && bank.lastRow != -1) {
+        bool is_hit = bank.lastRow == (int)coordinates.row;
+        stats.pagePredictionCount += 1;
+        if (is_hit != (bank.pageCounter >= 2)) stats.pageMispredictionCount += 1;
+        if (is_hit && bank.pageCounter < 3) bank.pageCounter += 1;
+        if (!is_hit && bank.pageCounter > 0) bank.pageCounter -= 1;
+    }
+    bank.lastRow = coordinates.row;
+    
+    // closed by the precharge policy while idle, but for rows predicted to be
+    // hit; not before tRAS and write recovery allow, until then it stays open
+    int64_t precharge = std::max(bank.preReadyTime, bank.accessTime + policy.max_row_idle);
+    if (bank.row != -1 && time > precharge && !is_adaptive) {
+        start = std::max(start, precharge + timing.bank.pre_to_act);
+        stats.commandCount[COMMAND_precharge] += 1;
+        bank.row = -1;
+    }
+    
+    int64_t column;
+    if (bank.row == (int)coordinates.row && bank.hits < policy.max_row_hits) {
+        hitCount += 1;
+        column = start;
+    } else {
+        int64_t activate = start;
+        if (bank.row != -1) {
+            conflictCount += 1;
+            activate = std::max(start, bank.preReadyTime) + timing.bank.pre_to_act;
+            stats.commandCount[COMMAND_precharge] += 1;
+        } else {
+            missCount += 1;
+        }
+        // Power up, if every row has closed and the rank has idled long
+        // enough to power down, or to enter self-refresh
+        if (policy.selfrefresh_idle > 0 && time > rank.idleTime + policy.selfrefresh_idle) {
+            rank.wakeTime = time + timing.rank.selfrefresh_exit_latency;
+        } else if (time > rank.idleTime + policy.powerdown_idle) {
+            rank.wakeTime = std::max(rank.wakeTime, time + timing.rank.powerup_latency);
+        }
+        activate = std::max(activate, rank.wakeTime);
+        activate = fit(activate, false, rank.activates, actSpacing);
+        stats.commandCount[COMMAND_activate] += 1;
+        
+        bank.row = coordinates.row;
+        bank.hits = 0;
+        bank.preReadyTime = activate + timing.bank.act_to_pre;
+        column = activate + (is_write ? timing.bank.act_to_write : timing.bank.act_to_read);
+    }
+    
+    // the rank and then the bus of the channel, in turn
+    column = fit(column, is_write, rank.accesses, rankSpacing);
+    column = fit(column, is_write, bus.accesses, busSpacing);
+    
+    precharge = column + (is_write ? timing.bank.write_to_pre : timing.bank.read_to_pre);
+    bank.preReadyTime = std::max(bank.preReadyTime, precharge);
+    bank.hits += 1;
+    bank.readyTime  = column;
+    bank.accessTime = column;
+    
+    // closed with auto-precharge; hybrid pages stay open, as the model
+    // cannot see which hits are still queued
+    bool is_closing = policy.page_policy == PAGE_close ||
+        (is_adaptive && (bank.pageCounter < 2 || bank.hits >= policy.max_row_hits));
+    if (is_closing) {
+        bank.row = -1;
+        bank.readyTime = bank.preReadyTime + timing.bank.pre_to_act;
+    }
+    rank.idleTime = std::max(rank.idleTime, std::max(bank.preReadyTime, column + policy.max_row_idle));
+    
+    int64_t release = column + (is_write ? timing.bank.write_to_data : timing.bank.read_to_data);
+    lastClock = std::max(lastClock, release);
+    
+    flights[bus.count++] = release;
+    std::push_heap(flights, flights + bus.count, std::greater<int64_t>());
+    
+    if (is_write) {
+        stats.writeCount += 1;
+        stats.writeLatency += release - clock;
+        stats.commandCount[is_closing ? COMMAND_write_precharge : COMMAND_write] += 1;
+    } else {
+        stats.readCount += 1;
+        stats.readLatency += release - clock;
+        stats.commandCount[is_closing ? COMMAND_read_precharge : COMMAND_read] += 1;
+    }
+    
+    if (listener) {
+        Completion completion = {id, address, clock, release};
+        listener->complete(completion);
+    }
+    
+    return true;
+}
+
+void LatencyModel::setListener(Listener *listener)
+{
+    this->listener = listener;
+}
+
+void LatencyModel::getStatistics(Statistics &stats)
+{
+    Energy &energy = config->energy;
+    
+    stats.readCount    += this->stats.readCount;
+    stats.writeCount   += this->stats.writeCount;
+    stats.readLatency  += this->stats.readLatency;
+    stats.writeLatency += this->stats.writeLatency;
+    
+    for (int type=0; type<=COMMAND_selfrefresh_exit; ++type) {
+        stats.commandCount[type] += this->stats.commandCount[type];
+    }
+    stats.rowHitCount  += hitCount;
+    stats.rowMissCount += missCount + conflictCount;
+    stats.pagePredictionCount    += this->stats.pagePredictionCount;
+    stats.pageMispredictionCount += this->stats.pageMispredictionCount;
+    
+    stats.actEnergy     += energy.act*this->stats.commandCount[COMMAND_activate];
+    stats.readEnergy    += energy.read*(this->stats.commandCount[COMMAND_read] +
+        this->stats.commandCount[COMMAND_read_precharge]);
+    stats.writeEnergy   += energy.write*(this->stats.commandCount[COMMAND_write] +
+        this->stats.commandCount[COMMAND_write_precharge]);
+    stats.refreshEnergy += energy.refresh*this->stats.commandCount[COMMAND_refresh];
+    stats.refreshEnergy += energy.refresh_bank*this->stats.commandCount[COMMAND_refresh_bank];
+}
+
+void LatencyModel::getRowStatistics(uint64_t &hits, uint64_t &misses, uint64_t &conflicts)
+{
+    hits      = hitCount;
+    misses    = missCount;
+    conflicts = conflictCount;
+}
+
+
+
+/** Set bits of the lowest count set bits of mask, words long, in marks;
+ *  how many were set. */
+static uint32_t markLowest(const uint64_t *mask, size_t words, uint32_t count, uint64_t *marks)
+{
+    uint32_t marked = 0;
+    for (size_t i=0; i<words && marked < count; ++i) {
+        for (uint64_t bits = mask[i]; bits && marked < count; bits &= bits - 1) {
+            marks[i] |= bits & -bits;
+            marked += 1;
+        }
+    }
+    
+    return marked;
+}
+
+/** Add a tier of the pending transactions of source within filter, if any. */
+static void addSourceTier(const PendingTransactions &pending, uint32_t source, const uint64_t *filter,
+    Priorities &priorities, bool is_new_group, uint64_t *scratch)
+{
+    const uint64_t *mask = pending.sourceMasks + source*pending.words;
+    uint64_t any = 0;
+    for (size_t i=0; i<pending.words; ++i) {
+        scratch[i] = mask[i] & filter[i];
+        any |= scratch[i];
+    }
+    if (any) priorities.add(scratch, is_new_group);
+}
+
+/** First ready, first come, first served: a single tier of every slot,
+ *  set once. */
+class FrFcfsScheduler : public Scheduler
+{
+public:
+    void prioritize(int64_t clock, const PendingTransactions &pending, Priorities &priorities, uint64_t *marks) {
+        if (priorities.size() > 0) return;
+        
+        std::vector<uint64_t> every(pending.words, ~(uint64_t)0);
+        priorities.add(&every[0], true);
+    }
+};
+
+/** Parallelism-aware batch scheduling (Mutlu and Moscibroda, ISCA 2008).
+ *  Once a batch is served, the marking_cap oldest transactions of each
+ *  source and bank form the next one, which goes first; sources with the
+ *  fewest in their busiest bank, then in all, are ranked first. */
+class ParBsScheduler : public Scheduler
+{
+protected:
+    uint32_t cap;
+    std::vector<uint32_t> rank; /**< Sources, first ranked first. */
+    std::vector<uint64_t> batch; /**< Scratch of marked slots. */
+    std::vector<uint64_t> scratch;
+
+public:
+    ParBsScheduler(Config *config) :
+        cap(config->scheduling.marking_cap),
+        rank(config->nSource)
+    {
+        for (uint32_t source=0; source<config->nSource; ++source) rank[source] = source;
+    }
+    
+    void prioritize(int64_t clock, const PendingTransactions &pending, Priorities &priorities, uint64_t *marks) {
+        size_t words = pending.words;
+        batch.assign(pending.markMask, pending.markMask + words);
+        scratch.resize(words);
+        
+        uint64_t any = 0;
+        for (size_t i=0; i<words; ++i) any |= batch[i];
+        if (!any) {
+            std::vector<uint32_t> maxLoad(pending.nSource, 0), totalLoad(pending.nSource, 0);
+            for (uint32_t source=0; source<pending.nSource; ++source) {
+                for (uint32_t bank=0; bank<pending.nBank; ++bank) {
+                    for (size_t i=0; i<words; ++i) {
+                        scratch[i] = pending.sourceMasks[source*words + i] & pending.bankMasks[bank*words + i];
+                    }
+                    uint32_t load = markLowest(&scratch[0], words, cap, marks);
+                    maxLoad[source] = std::max(maxLoad[source], load);
+                    totalLoad[source] += load;
+                }
+            }
+            std::sort(rank.begin(), rank.end(), [&](uint32_t a, uint32_t b) {
+                if (maxLoad[a] != maxLoad[b]) return maxLoad[a] < maxLoad[b];
+                if (totalLoad[a] != totalLoad[b]) return totalLoad[a] < totalLoad[b];
+                return a < b;
+            });
+            batch.assign(marks, marks + words);
+        }
+        
+        priorities.clear();
+        for (uint32_t i=0; i<rank.size(); ++i) {
+            addSourceTier(pending, rank[i], &batch[0], priorities, i == 0, &scratch[0]);
+        }
+        for (size_t i=0; i<words; ++i) batch[i] = pending.occupied[i] & ~batch[i];
+        for (uint32_t i=0; i<rank.size(); ++i) {
+            addSourceTier(pending, rank[i], &batch[0], priorities, i == 0, &scratch[0]);
+        }
+    }
+    
+    void checkpoint(Checkpoint &checkpoint) {
+        checkpoint.io(&rank[0], rank.size()*sizeof(uint32_t));
+    }
+};
+
+/** Adaptive per-thread least-attained-service scheduling (Kim et al., HPCA
+ *  2010). Every quantum sources are ranked by the reads and writes they
+ *  were served, decayed over past quanta, the least served first; a rank
+ *  goes before the row hits of those below it. */
+class AtlasScheduler : public Scheduler
+{
+protected:
+    static constexpr double decay = 0.875;
+    
+    uint32_t quantum;
+    int64_t rankTime; /**< End of the current quantum. */
+    std::vector<uint64_t> served; /**< This quantum, by source. */
+    std::vector<double> attained; /**< Over past quanta, by source. */
+    std::vector<uint32_t> rank;
+    std::vector<uint64_t> scratch;
+
+public:
+    AtlasScheduler(Config *config) :
+        quantum(config->scheduling.quantum),
+        rankTime(config->scheduling.quantum),
+        served(config->nSource, 0),
+        attained(config->nSource, 0),
+        rank(config->nSource)
+    {
+        for (uint32_t source=0; source<config->nSource; ++source) rank[source] = source;
+    }
+    
+    void prioritize(int64_t clock, const PendingTransactions &pending, Priorities &priorities, uint64_t *marks) {
+        // nothing is served between events, so a late ranking is the same
+        for (; clock >= rankTime; rankTime += quantum) {
+            for (size_t source=0; source<served.size(); ++source) {
+                attained[source] = decay*attained[source] + (1-decay)*served[source];
+                served[source] = 0;
+            }
+            std::sort(rank.begin(), rank.end(), [&](uint32_t a, uint32_t b) {
+                return attained[a] != attained[b] ? attained[a] < attained[b] : a < b;
+            });
+        }
+        
+        // sources served alike share a tier, as all do before the first ranking
+        size_t words = pending.words;
+        scratch.assign(words, 0);
+        priorities.clear();
+        for (uint32_t i=0; i<rank.size(); ++i) {
+            const uint64_t *mask = pending.sourceMasks + rank[i]*words;
+            for (size_t j=0; j<words; ++j) scratch[j] |= mask[j];
+            
+            if (i+1 == rank.size() || attained[rank[i+1]] != attained[rank[i]]) {
+                priorities.add(&scratch[0], true);
+                std::fill(scratch.begin(), scratch.end(), 0);
+            }
+        }
+    }
+    
+    void serve(int64_t clock, uint32_t source) {
+        served[source] += 1;
+    }
+    
+    void checkpoint(Checkpoint &checkpoint) {
+        checkpoint.io(rankTime);
+        checkpoint.io(&served[0], served.size()*sizeof(uint64_t));
+        checkpoint.io(&attained[0], attained.size()*sizeof(double));
+        checkpoint.io(&rank[0], rank.size()*sizeof(uint32_t));
+    }
+};
+
+/** Blacklisting scheduling (Subramanian et al., ICCD 2014). A source served
+ *  blacklist_streak times in a row is blacklisted until the list is next
+ *  cleared, and the others go first, before row hits of blacklisted ones. */
+class BlissScheduler : public Scheduler
+{
+protected:
+    uint32_t streak;
+    uint32_t interval;
+    int64_t clearTime; /**< When the blacklist is cleared next. */
+    uint32_t lastSource;
+    uint32_t count; /**< Served in a row from lastSource. */
+    std::vector<uint8_t> is_blacklisted;
+    std::vector<uint64_t> mask[2]; /**< Scratch of the sources in and out. */
+
+public:
+    BlissScheduler(Config *config) :
+        streak(config->scheduling.blacklist_streak),
+        interval(config->scheduling.blacklist_interval),
+        clearTime(config->scheduling.blacklist_interval),
+        lastSource(0),
+        count(0),
+        is_blacklisted(config->nSource, 0)
+    {
+    }
+    
+    void prioritize(int64_t clock, const PendingTransactions &pending, Priorities &priorities, uint64_t *marks) {
+        if (clock >= clearTime) {
+            std::fill(is_blacklisted.begin(), is_blacklisted.end(), 0);
+            clearTime += (clock - clearTime)/interval*interval + interval;
+        }
+        
+        for (int i=0; i<2; ++i) mask[i].assign(pending.words, 0);
+        for (uint32_t source=0; source<pending.nSource; ++source) {
+            uint64_t *tier = &mask[is_blacklisted[source]][0];
+            for (size_t i=0; i<pending.words; ++i) tier[i] |= pending.sourceMasks[source*pending.words + i];
+        }
+        
+        priorities.clear();
+        for (int i=0; i<2; ++i) priorities.add(&mask[i][0], true);
+    }
+    
+    void serve(int64_t clock, uint32_t source) {
+        count = source == lastSource ? count + 1 : 1;
+        lastSource = source;
+        if (count >= streak) is_blacklisted[source] = 1;
+    }
+    
+    void checkpoint(Checkpoint &checkpoint) {
+        checkpoint.io(clearTime);
+        checkpoint.io(lastSource);
+        checkpoint.io(count);
+        checkpoint.io(&is_blacklisted[0], is_blacklisted.size());
+    }
+};
+
+Scheduler *Scheduler::create(Config *config)
+{
+    switch (config->scheduling.type) {
+        case SCHEDULER_parbs:
+            return new ParBsScheduler(config);
+        case SCHEDULER_atlas:
+            return new AtlasScheduler(config);
+        case SCHEDULER_bliss:
+            return new BlissScheduler(config);
+        default:
+            return new FrFcfsScheduler();
+    }
+}
+
+// out-of-line definitions, as timing() and policy() bind references to these
+constexpr TimingParameters DDR3_1600::parameters;
+constexpr Timing DDR3_1600::m_timing;
+constexpr Policy DDR3_1600::m_policy;
+
+bool DDR3_1600::matches(Config *config)
+{
+    return config->nRank == nRank() && config->nBank == nBank() &&
+        memcmp(&config->timing, &m_timing, sizeof(Timing)) == 0 &&
+        memcmp(&config->policy, &m_policy, sizeof(Policy)) == 0;
+}
+
+Controller *Controller::create(Config *config, bool specialize)
+{
+    if (specialize && DDR3_1600::matches(config)) {
+        return new MemoryController<DDR3_1600>(config);
+    }
+    
+    return new MemoryController<RuntimeSpec>(config);
+}
+
+template<class Spec>
+MemoryController<Spec>::MemoryController(Config *_config) :
+    config(_config),
+    spec(_config),
+    channel(_config),
+    requestQueue(config->nRequest),
+    dataBuffer(config->nRequest),
+    releaseWheel(config->nRequest, 256),
+    transactionQueue(config->nTransaction + config->nWrite),
+    commandQueue(config->nCommand),
+    arrivals(config->nRequest),
+    priorities(transactionQueue.words())
+{
+    Coordinates coordinates = {0};
+    uint32_t refresh_step = channel.getRefreshInterval()/spec.nRank();
+    
+    stats = Statistics();
+    
+    listener = NULL;
+    
+    completionMemory = NULL;
+    completions = NULL;
+    earlyCompletions = false;
+    overflowCount = 0;
+    
+    size_t words = transactionQueue.words();
+    bankMasks = new uint64_t[spec.nRank()*spec.nBank()*words]();
+    writeMask = new uint64_t[words]();
+    candidateMask = new uint64_t[words]();
+    pendingReads  = 0;
+    pendingWrites = 0;
+    is_draining   = false;
+    lastDirection = -1;
+    sourceMasks = new uint64_t[config->nSource*words]();
+    markMask    = new uint64_t[words]();
+    scheduler   = Scheduler::create(config);
+    
+    for (coordinates.rank=0; coordinates.rank<spec.nRank(); ++coordinates.rank) {
+        // initialize rank
+        RankData &rank = channel.getRankData(coordinates);
+        rank.demandCount = 0;
+        rank.activeCount = 0;
+        rank.refreshTime = refresh_step*(coordinates.rank+1);
+        rank.refreshDebt = 0;
+        rank.refreshBank = 0;
+        rank.refreshMask = 0;
+        rank.idleTime    = -1;
+        rank.is_sleeping = false;
+        rank.is_selfrefreshing = false;
+        
+        for (coordinates.bank=0; coordinates.bank<spec.nBank(); ++coordinates.bank) {
+            // initialize bank
+            BankRef bank = channel.getBankRef(coordinates);
+            bank.demandCount = 0;
+            bank.rowBuffer = -1;
+        }
+    }
+}
+
+template<class Spec>
+MemoryController<Spec>::~MemoryController()
+{
+    delete [] bankMasks;
+    delete [] writeMask;
+    delete [] candidateMask;
+    delete [] sourceMasks;
+    delete [] markMask;
+    delete scheduler;
+    
+    delete completions;
+    free(completionMemory);
+}
+
+template<class Spec>
+void MemoryController<Spec>::pushRequest(int64_t clock, uint64_t address, bool is_write, uint64_t id,
+    uint16_t source, const Coordinates &coordinates)
+{
+    Request &request = dataBuffer.push();
+    
+    request.id = id;
+    request.address = address;
+    request.is_write = is_write;
+    request.source = source;
+    request.coordinates = coordinates;
+    
+    request.allocateTime = clock;
+    request.releaseTime  = -1;
+    
+    requestQueue.push() = &request;
+}
+
+template<class Spec>
+bool MemoryController<Spec>::addRequest(int64_t clock, uint64_t address, bool is_write, uint64_t id,
+    uint16_t source)
+{
+    if (dataBuffer.is_full()) return false;
+    
+    /** Address mapping scheme goes here. */
+    Coordinates coordinates;
+    decode(config->mapping, address, coordinates);
+    
+    pushRequest(clock, address, is_write, id, source, coordinates);
+    
+    return true;
+}
+
+template<class Spec>
+size_t MemoryController<Spec>::addRequests(int64_t clock, const Submission *requests,
+    const Coordinates *coordinates, const uint32_t *order, size_t count)
+{
+    size_t added = std::min(count, getRoom());
+    
+    for (size_t i=0; i<added; ++i) {
+        const Submission &request = requests[order[i]];
+        pushRequest(clock, request.address, request.is_write, request.id, request.source,
+            coordinates[order[i]]);
+    }
+    
+    return added;
+}
+
+template<class Spec>
+size_t MemoryController<Spec>::getRoom()
+{
+    return dataBuffer.size() - dataBuffer.length();
+}
+
+template<class Spec>
+bool MemoryController<Spec>::stageRequest(int64_t clock, uint64_t address, bool is_write, uint64_t id,
+    uint16_t source)
+{
+    // requests only retire during run(), so this many are sure to fit
+    if (dataBuffer.length() + arrivals.length() >= dataBuffer.size()) return false;
+    
+    Request &request = arrivals.push();
+    
+    request.id = id;
+    request.address = address;
+    request.is_write = is_write;
+    request.source = source;
+    request.allocateTime = clock;
+    
+    return true;
+}
+
+template<class Spec>
+void MemoryController<Spec>::run(int64_t from, int64_t to, bool event_driven)
+{
+    int64_t clock = from;
+    
+    while (true) {
+        while (!arrivals.is_empty() && arrivals.first().allocateTime <= clock) {
+            Request &request = arrivals.shift();
+            bool accepted = addRequest(clock, request.address, request.is_write, request.id, request.source);
+            assert(accepted); (void)accepted;
+        }
+        
+        if (clock >= to) break;
+        
+        cycle(clock);
+        
+        if (event_driven) {
+            int64_t next = getNextEventTime(clock);
+            if (!arrivals.is_empty()) {
+                next = std::min(next, arrivals.first().allocateTime);
+            }
+            // still run the last cycle so that energy covers the whole epoch
+            clock = std::min(next, std::max(clock + 1, to - 1));
+        } else {
+            clock += 1;
+        }
+    }
+}
+
+static inline void setBit(uint64_t *mask, int index)
+{
+    mask[index/64] |= (uint64_t)1 << index%64;
+}
+
+static inline void clearBit(uint64_t *mask, int index)
+{
+    mask[index/64] &= ~((uint64_t)1 << index%64);
+}
+
+template<class Spec>
+uint64_t *MemoryController<Spec>::getBankMask(Coordinates &coordinates)
+{
+    return &bankMasks[(coordinates.rank*spec.nBank() + coordinates.bank)*transactionQueue.words()];
+}
+
+/** Pending transactions of the source of transaction, folded onto nSource. */
+template<class Spec>
+uint64_t *MemoryController<Spec>::getSourceMask(Transaction &transaction)
+{
+    return sourceMasks + transaction.request->source % config->nSource*transactionQueue.words();
+}
+
+template<class Spec>
+uint64_t *MemoryController<Spec>::getRowMask(Coordinates &coordinates, uint32_t row)
+{
+    uint64_t key = (uint64_t)(coordinates.rank*spec.nBank() + coordinates.bank) << 32 | row;
+    
+    std::vector<uint64_t> &mask = rowMasks[key];
+    if (mask.empty()) mask.resize(transactionQueue.words());
+    
+    return &mask[0];
+}
+
+/** True if request finds no room among the transactions, or in the write
+ *  buffer for a write if there is one. */
+template<class Spec>
+bool MemoryController<Spec>::is_full(Request &request)
+{
+    if (config->nWrite == 0) return transactionQueue.is_full();
+    
+    return request.is_write ? pendingWrites == config->nWrite : pendingReads == config->nTransaction;
+}
+
+template<class Spec>
+bool MemoryController<Spec>::addTransaction(int64_t clock, Request &request)
+{
+    if (is_full(request)) return false;
+    
+    if (transactionQueue.is_spread()) compactTransactions();
+    
+    Transaction &transaction = transactionQueue.push();
+    
+    transaction.request = &request;
+    transaction.is_marked = false;
+    
+    (Coordinates &)transaction = request.coordinates;
+    
+    RankData &rank = channel.getRankData(transaction);
+    BankRef bank = channel.getBankRef(transaction);
+    rank.demandCount += 1;
+    bank.demandCount += 1;
+    
+    if ((int)transaction.row == bank.rowBuffer) {
+        bank.supplyCount += 1;
+    }
+    
+    if (request.is_write) {
+        pendingWrites += 1;
+    } else {
+        pendingReads += 1;
+    }
+    
+    indexTransaction(transaction);
+    
+    return true;
+}
+
+template<class Spec>
+void MemoryController<Spec>::indexTransaction(Transaction &transaction)
+{
+    int slot = transactionQueue.index(transaction);
+    
+    setBit(getBankMask(transaction), slot);
+    setBit(getRowMask(transaction, transaction.row), slot);
+    setBit(getSourceMask(transaction), slot);
+    if (transaction.request->is_write) setBit(writeMask, slot);
+    if (transaction.is_marked) setBit(markMask, slot);
+}
+
+template<class Spec>
+void MemoryController<Spec>::compactTransactions()
+{
+    size_t words = transactionQueue.words();
+    
+    transactionQueue.compact();
+    
+    std::fill(bankMasks, bankMasks + spec.nRank()*spec.nBank()*words, 0);
+    std::fill(writeMask, writeMask + words, 0);
+    std::fill(sourceMasks, sourceMasks + config->nSource*words, 0);
+    std::fill(markMask, markMask + words, 0);
+    rowMasks.clear();
+    
+    const uint64_t *occupied = transactionQueue.occupied();
+    for (size_t i=0; i<words; ++i) {
+        for (uint64_t bits = occupied[i]; bits; bits &= bits - 1) {
+            indexTransaction(transactionQueue[i*64 + __builtin_ctzll(bits)]);
+        }
     }
 }
 
-MemoryControllerHub::~MemoryControllerHub()
+template<class Spec>
+void MemoryController<Spec>::removeTransaction(Transaction &transaction)
 {
-    for (uint32_t i=0; i<config->nChannel; ++i) {
-        delete controllers[i];
+    size_t words = transactionQueue.words();
+    int slot = transactionQueue.index(transaction);
+    
+    uint64_t key = (uint64_t)(transaction.rank*spec.nBank() + transaction.bank) << 32 | transaction.row;
+    std::unordered_map<uint64_t, std::vector<uint64_t> >::iterator row = rowMasks.find(key);
+    assert(row != rowMasks.end());
+    
+    clearBit(getBankMask(transaction), slot);
+    clearBit(&row->second[0], slot);
+    clearBit(getSourceMask(transaction), slot);
+    clearBit(writeMask, slot);
+    clearBit(markMask, slot);
+    
+    uint64_t any = 0;
+    for (size_t i=0; i<words; ++i) any |= row->second[i];
+    if (!any) rowMasks.erase(row);
+    
+    if (transaction.request->is_write) {
+        pendingWrites -= 1;
+    } else {
+        pendingReads -= 1;
     }
-    delete [] controllers;
-
-    /*std::cerr << "---\n";
-    for(int i=0; i<bins; ++i) {
-        std::cerr << hist[i] << "\n";
-    }*/
+    
+    transactionQueue.remove(transaction);
 }
 
-bool MemoryControllerHub::addRequest(int64_t clock, uint64_t address, bool is_write)
+template<class Spec>
+bool MemoryController<Spec>::is_ready(int64_t clock, CommandType type, Coordinates &coordinates)
 {
-    AddressMapping &mapping = config->mapping;
-    
-    int channel = mapping.channel.value(address);
-    
-    return controllers[channel]->addRequest(clock, address, is_write);
+    return channel.getReadyTime(type, coordinates) <= clock + spec.timing().command_delay;
 }
 
-void MemoryControllerHub::cycle(int64_t clock)
+/** True if the open row of bank has hits pending that may go now, so that
+ *  misses of priority group wait for them. Only hits of that group or an
+ *  earlier one count, and while writes drain only write hits, otherwise
+ *  only read ones, lest a bank wait for hits held back. */
+template<class Spec>
+bool MemoryController<Spec>::is_supplied(Coordinates &coordinates, BankRef &bank, int group)
 {
-    for (uint8_t channel=0; channel<config->nChannel; ++channel) {
-        controllers[channel]->cycle(clock);
+    if (bank.supplyCount == 0) return false;
+    if (spec.policy().write_high == 0 && priorities.is_last(group)) return true;
+    
+    uint64_t *hits = getRowMask(coordinates, bank.rowBuffer);
+    const uint64_t *scope = priorities.getScope(group);
+    uint64_t direction = spec.policy().write_high == 0 ? ~(uint64_t)0 : 0;
+    for (size_t i=0; i<transactionQueue.words(); ++i) {
+        uint64_t writes = is_draining ? writeMask[i] : ~writeMask[i];
+        if (hits[i] & scope[i] & (writes | direction)) return true;
     }
     
-    /*if ((clock+1) % 4000 == 0) {
-        std::cerr << read_count << "\t" << write_count << "\n";
-        read_count = write_count = 0;
-    }*/
+    return false;
 }
 
-
-
-MemoryController::MemoryController(Config *_config) :
-    config(_config),
-    channel(_config),
-    requestQueue(config->nRequest),
-    dataBuffer(config->nRequest),
-    transactionQueue(config->nTransaction),
-    commandQueue(config->nCommand)
+/** Have the scheduler set the priorities of the pending transactions, and
+ *  mark those it picks. */
+template<class Spec>
+void MemoryController<Spec>::prioritize(int64_t clock)
 {
-    Coordinates coordinates = {0};
-    uint32_t refresh_step = config->timing.rank.refresh_interval/config->nRank;
+    size_t words = transactionQueue.words();
+    PendingTransactions pending = {
+        words, config->nSource, spec.nRank()*spec.nBank(),
+        transactionQueue.occupied(), sourceMasks, bankMasks, markMask
+    };
     
-    for (coordinates.rank=0; coordinates.rank<config->nRank; ++coordinates.rank) {
-        // initialize rank
-        RankData &rank = channel.getRankData(coordinates);
-        rank.demandCount = 0;
-        rank.activeCount = 0;
-        rank.refreshTime = refresh_step*(coordinates.rank+1);
-        rank.is_sleeping = false;
-        
-        for (coordinates.bank=0; coordinates.bank<config->nBank; ++coordinates.bank) {
-            // initialize bank
-            BankData &bank = channel.getBankData(coordinates);
-            bank.demandCount = 0;
-            bank.rowBuffer = -1;
+    // candidateMask is free until the schedule policy
+    uint64_t *marks = candidateMask;
+    std::fill(marks, marks + words, 0);
+    scheduler->prioritize(clock, pending, priorities, marks);
+    
+    for (size_t i=0; i<words; ++i) {
+        for (uint64_t bits = marks[i]; bits; bits &= bits - 1) {
+            int slot = i*64 + __builtin_ctzll(bits);
+            transactionQueue[slot].is_marked = true;
+            setBit(markMask, slot);
         }
     }
 }
 
-MemoryController::~MemoryController()
+/** The command that wakes rank from power-down or self-refresh. */
+template<class Spec>
+CommandType MemoryController<Spec>::getWakeCommand(RankData &rank)
 {
+    return rank.is_selfrefreshing ? COMMAND_selfrefresh_exit : COMMAND_powerup;
 }
 
-bool MemoryController::addRequest(int64_t clock, uint64_t address, bool is_write)
+/** Banks of the rank at coordinates kept from new work for a refresh:
+ *  every bank, or per bank the next one, once more refreshes are due than
+ *  may be postponed, or while they have no work and a refresh may be
+ *  pulled in. */
+template<class Spec>
+uint64_t MemoryController<Spec>::getRefreshMask(Coordinates &coordinates)
 {
-    if (dataBuffer.is_full()) return false;
-    
-    Request &request = dataBuffer.push();
+    const Policy &policy = spec.policy();
     
-    request.address = address;
-    request.is_write = is_write;
+    RankData &rank = channel.getRankData(coordinates);
+    uint64_t banks = ~(uint64_t)0 >> (64 - spec.nBank());
+    int32_t demand = rank.demandCount;
     
-    request.allocateTime = clock;
-    request.releaseTime  = -1;
+    if (policy.refresh_per_bank) {
+        Coordinates target = coordinates;
+        target.bank = rank.refreshBank;
+        banks = (uint64_t)1 << target.bank;
+        demand = channel.getBankRef(target).demandCount;
+    }
     
-    requestQueue.push() = &request;
+    if (rank.refreshDebt > policy.refresh_postpone) return banks;
+    if (rank.refreshDebt > -(int32_t)policy.refresh_pullin && demand == 0) return banks;
     
-    return true;
+    return 0;
 }
 
-bool MemoryController::addTransaction(int64_t clock, Request &request)
+/** Set candidateMask to the slots of transactions whose next command can
+ *  issue now, with row misses waiting for the row hits of priority group
+ *  and those before it, and only reads or writes as readable and writable. */
+template<class Spec>
+void MemoryController<Spec>::findCandidates(int64_t clock, int group, uint64_t readable, uint64_t writable)
 {
-    if (transactionQueue.is_full()) return false;
+    const Policy &policy = spec.policy();
     
-    Transaction &transaction = transactionQueue.push();
+    size_t words = transactionQueue.words();
+    Coordinates coordinates = {0};
     
-    transaction.request = &request;
+    // Slots of transactions whose next command is ready, by bank
+    std::fill(candidateMask, candidateMask + words, 0);
+    for (coordinates.rank = 0; coordinates.rank < spec.nRank(); ++coordinates.rank) {
+        RankData &rank = channel.getRankData(coordinates);
+        
+        if (rank.demandCount == 0) continue;
+        
+        // Power up comes first
+        if (rank.is_sleeping && !is_ready(clock, getWakeCommand(rank), coordinates)) continue;
+        
+        // make way for Refresh
+        uint64_t busy = channel.getBusyBanks(coordinates) & ~rank.refreshMask;
+        for (uint64_t banks = busy; banks; banks &= banks-1) {
+            coordinates.bank = __builtin_ctzll(banks);
+            BankRef bank = channel.getBankRef(coordinates);
+            
+            uint64_t *mask = getBankMask(coordinates);
+            uint64_t reads = readable, writes = writable;
+            
+            if (rank.is_sleeping) {
+                // Power up
+            } else if (bank.rowBuffer == -1) {
+                // Activate
+                if (!is_ready(clock, COMMAND_activate, coordinates)) continue;
+            } else if (!is_supplied(coordinates, bank, group)) {
+                // Precharge for a row miss
+                if (!is_ready(clock, COMMAND_precharge, coordinates)) continue;
+            } else {
+                // row misses wait for row hits
+                mask = getRowMask(coordinates, bank.rowBuffer);
+                
+                if (bank.hitCount >= policy.max_row_hits) {
+                    // Precharge for a row hit
+                    if (!is_ready(clock, COMMAND_precharge, coordinates)) continue;
+                } else {
+                    // Read / Write
+                    if (!is_ready(clock, COMMAND_read, coordinates)) reads = 0;
+                    if (!is_ready(clock, COMMAND_write, coordinates)) writes = 0;
+                    if (!reads && !writes) continue;
+                }
+            }
+            
+            for (size_t i=0; i<words; ++i) {
+                candidateMask[i] |= mask[i] & ((writeMask[i] & writes) | (~writeMask[i] & reads));
+            }
+        }
+    }
+}
     
-    /** Address mapping scheme goes here. */
-    AddressMapping &mapping = config->mapping;
+/** The first transaction after cursor whose next command can issue now,
+ *  tier by tier of the priorities and oldest first within each, with
+ *  cursor left at it as tier*slots + slot. Readiness only changes when a
+ *  command issues, so visiting these in turn is the same as trying every
+ *  transaction in that order. */
+template<class Spec>
+Transaction *MemoryController<Spec>::nextTransaction(int64_t clock, int &cursor)
+{
+    const Policy &policy = spec.policy();
     
-    transaction.channel = mapping.channel.value(request.address);
-    transaction.rank    = mapping.rank.value(request.address);
-    transaction.bank    = mapping.bank.value(request.address);
-    transaction.row     = mapping.row.value(request.address);
-    transaction.column  = mapping.column.value(request.address);
+    size_t words = transactionQueue.words();
+    int slots = words*64;
     
-    RankData &rank = channel.getRankData(transaction);
-    BankData &bank = channel.getBankData(transaction);
-    rank.demandCount += 1;
-    bank.demandCount += 1;
+    if (commandQueue.is_full()) return NULL;
     
-    if ((int)transaction.row == bank.rowBuffer) {
-        bank.supplyCount += 1;
+    // Writes go on their own while draining, and reads do otherwise
+    uint64_t readable = ~(uint64_t)0, writable = ~(uint64_t)0;
+    if (policy.write_high > 0) {
+        if (is_draining) readable = 0; else writable = 0;
     }
     
-    return true;
+    int group = -1;
+    for (int tier = (cursor+1)/slots; tier < priorities.size(); ++tier) {
+        if (priorities.getGroup(tier) != group) {
+            group = priorities.getGroup(tier);
+            findCandidates(clock, group, readable, writable);
+        }
+        
+        // The oldest of them after cursor is the lowest slot
+        const uint64_t *mask = priorities.getTier(tier);
+        int slot = tier == (cursor+1)/slots ? (cursor+1)%slots : 0;
+        for (size_t i=slot/64; i<words; ++i) {
+            uint64_t bits = candidateMask[i] & mask[i];
+            if (i == (size_t)slot/64) bits &= ~(uint64_t)0 << slot%64;
+            if (bits) {
+                cursor = tier*slots + i*64 + __builtin_ctzll(bits);
+                return &transactionQueue[i*64 + __builtin_ctzll(bits)];
+            }
+        }
+    }
+    
+    return NULL;
 }
 
-bool MemoryController::addCommand(int64_t clock, CommandType type, Coordinates &coordinates, Request *request)
+template<class Spec>
+bool MemoryController<Spec>::addCommand(int64_t clock, CommandType type, Coordinates &coordinates, Request *request)
 {
     if (commandQueue.is_full())
         return false;
@@ -213,7 +1696,7 @@ bool MemoryController::addCommand(int64_t clock, CommandType type, Coordinates &
     int64_t readyTime, issueTime, finishTime;
     
     readyTime = channel.getReadyTime(type, coordinates);
-    issueTime = clock + config->timing.command_delay;
+    issueTime = clock + spec.timing().command_delay;
     if (readyTime > issueTime) return false;
     
     finishTime = channel.getFinishTime(issueTime, type, coordinates);
@@ -227,39 +1710,56 @@ bool MemoryController::addCommand(int64_t clock, CommandType type, Coordinates &
     command.issueTime   = issueTime;
     command.finishTime  = finishTime;
     
+    stats.commandCount[type] += 1;
+    
+    // only reads and writes serve a request, which is released on finish
+    if (request) {
+        int direction = request->is_write;
+        if (lastDirection != -1 && direction != lastDirection) stats.turnaroundCount += 1;
+        lastDirection = direction;
+    }
+    if (request && completions && earlyCompletions) {
+        Completion completion = {
+            request->id, request->address, request->allocateTime, finishTime
+        };
+        queueCompletion(completion);
+    }
+    
     /*static const char *mne[] = {
         "act", "pre", "read", "write", "read_pre", "write_pre", 
-        "refresh", "powerup", "powerdown",
+        "refresh", "refresh_bank", "powerup", "powerdown",
     };
     if (command.type < COMMAND_powerup)
     std::cout << issueTime
         << " " << mne[command.type]
         << " " << (int)coordinates.channel 
         << " " << (int)coordinates.rank
-        << " " << (command.type >= COMMAND_refresh ? 0 : (int)coordinates.bank)
+        << " " << (command.type == COMMAND_refresh ? 0 : (int)coordinates.bank)
         << " " << (command.type >= COMMAND_refresh || command.type == COMMAND_precharge ? 0 : (int)coordinates.row)
         << std::endl;*/
     
     return true;
 }
 
-void MemoryController::cycle(int64_t clock)
+template<class Spec>
+void MemoryController<Spec>::cycle(int64_t clock)
 {
     channel.cycle(clock);
     
-    Policy &policy = config->policy;
+    const Policy &policy = spec.policy();
     
     Coordinates coordinates = {0};
-    LinkedList<Request>::Iterator irq;
-    LinkedList<Transaction>::Iterator itq, itqs;
+    Request *released;
+    Transaction *next;
+    int cursor = -1;
     
     /** Request to Transaction */
     
     while (!requestQueue.is_empty()) {
         Request &request = *requestQueue.first();
         
-        int readyTime = request.allocateTime + config->timing.transaction_delay;
-        if (clock < readyTime) continue;
+        int64_t readyTime = request.allocateTime + spec.timing().transaction_delay;
+        if (clock < readyTime) break; // in-order
         
         if (!addTransaction(clock, request)) break; // in-order
         requestQueue.shift();
@@ -268,166 +1768,676 @@ void MemoryController::cycle(int64_t clock)
     /** Transaction to Command */
     
     // Refresh policy
-    for (coordinates.rank = 0; coordinates.rank < config->nRank; ++coordinates.rank) {
+    for (coordinates.rank = 0; coordinates.rank < spec.nRank(); ++coordinates.rank) {
         RankData &rank = channel.getRankData(coordinates);
         
-        if (clock < rank.refreshTime) continue;
+        // every deadline passed adds a refresh to do, but in self-refresh
+        while (clock >= rank.refreshTime) {
+            if (!rank.is_selfrefreshing) rank.refreshDebt += 1;
+            rank.refreshTime += channel.getRefreshInterval();
+        }
+        
+        rank.refreshMask = getRefreshMask(coordinates);
+        if (rank.refreshMask == 0) continue;
         
         // Power up
         if (rank.is_sleeping) {
-            if (!addCommand(clock, COMMAND_powerup, coordinates, NULL)) continue;
+            if (!addCommand(clock, getWakeCommand(rank), coordinates, NULL)) continue;
             rank.is_sleeping = false;
+            rank.is_selfrefreshing = false;
         }
         
         // Precharge
-        for (coordinates.bank = 0; coordinates.bank < config->nBank; ++coordinates.bank) {
-            BankData &bank = channel.getBankData(coordinates);
+        for (uint64_t banks = channel.getOpenBanks(coordinates) & rank.refreshMask; banks; banks &= banks-1) {
+            coordinates.bank = __builtin_ctzll(banks);
+            BankRef bank = channel.getBankRef(coordinates);
             
-            if (bank.rowBuffer != -1) {
-                if (!addCommand(clock, COMMAND_precharge, coordinates, NULL)) continue;
-                rank.activeCount -= 1;
-                bank.rowBuffer = -1;
-            }
+            if (!addCommand(clock, COMMAND_precharge, coordinates, NULL)) continue;
+            rank.activeCount -= 1;
+            bank.rowBuffer = -1;
         }
-        if (rank.activeCount > 0) continue;
+        if (channel.getOpenBanks(coordinates) & rank.refreshMask) continue;
         
         // Refresh
-        if (!addCommand(clock, COMMAND_refresh, coordinates, NULL)) continue;
-        rank.refreshTime += config->timing.rank.refresh_interval;
+        if (spec.policy().refresh_per_bank) {
+            coordinates.bank = rank.refreshBank;
+            if (!addCommand(clock, COMMAND_refresh_bank, coordinates, NULL)) continue;
+            rank.refreshBank = (rank.refreshBank + 1) % spec.nBank();
+        } else {
+            if (!addCommand(clock, COMMAND_refresh, coordinates, NULL)) continue;
+        }
+        rank.refreshDebt -= 1;
+        rank.refreshMask = getRefreshMask(coordinates);
+    }
+    
+    // Write drain policy
+    if (policy.write_high > 0) {
+        bool is_alone = pendingReads == 0 && pendingWrites > 0;
+        if (is_draining) {
+            is_draining = pendingWrites > policy.write_low || is_alone;
+        } else {
+            is_draining = pendingWrites >= policy.write_high || is_alone;
+        }
     }
     
     // Schedule policy
-    for (transactionQueue.reset(itq); transactionQueue.next(itq); ) {
-        Transaction &transaction = *itq;
+    prioritize(clock);
+    while ((next = nextTransaction(clock, cursor)) != NULL) {
+        Transaction &transaction = *next;
         RankData &rank = channel.getRankData(transaction);
-        BankData &bank = channel.getBankData(transaction);
+        
+        int group = priorities.getGroup(cursor/(transactionQueue.words()*64));
+        BankRef bank = channel.getBankRef(transaction);
         
         // make way for Refresh
-        if (clock >= rank.refreshTime) continue;
+        if (rank.refreshMask >> transaction.bank & 1) continue;
         
         // Power up
         if (rank.is_sleeping) {
-            if (!addCommand(clock, COMMAND_powerup, transaction, NULL)) continue;
+            if (!addCommand(clock, getWakeCommand(rank), transaction, NULL)) continue;
             rank.is_sleeping = false;
+            rank.is_selfrefreshing = false;
         }
         
         // Precharge
         if (bank.rowBuffer != -1 && (bank.rowBuffer != (int)transaction.row || 
             bank.hitCount >= policy.max_row_hits)) {
-            if (bank.rowBuffer != (int)transaction.row && bank.supplyCount > 0) continue;
+            if (bank.rowBuffer != (int)transaction.row && is_supplied(transaction, bank, group)) continue;
             if (!addCommand(clock, COMMAND_precharge, transaction, NULL)) continue;
             rank.activeCount -= 1;
             bank.rowBuffer = -1;
         }
         
-        // Activate
-        if (bank.rowBuffer == -1) {
-            if (!addCommand(clock, COMMAND_activate, transaction, NULL)) continue;
-            rank.activeCount += 1;
-            bank.rowBuffer = transaction.row;
-            bank.hitCount = 0;
-            bank.supplyCount = 0;
-            for (transactionQueue.reset(itqs); transactionQueue.next(itqs);) {
-                if ((*itqs).rank == transaction.rank && 
-                    (*itqs).bank == transaction.bank && 
-                    (*itqs).row == transaction.row) {
-                    bank.supplyCount += 1;
-                }
-            }
+        // Activate
+        if (bank.rowBuffer == -1) {
+            if (!addCommand(clock, COMMAND_activate, transaction, NULL)) continue;
+            rank.activeCount += 1;
+            bank.rowBuffer = transaction.row;
+            bank.hitCount = 0;
+            bank.supplyCount = 0;
+            uint64_t *hits = getRowMask(transaction, transaction.row);
+            for (size_t i=0; i<transactionQueue.words(); ++i) {
+                bank.supplyCount += __builtin_popcountll(hits[i]);
+            }
+        }
+        
+        // Read / Write
+        assert(bank.rowBuffer == (int)transaction.row);
+        assert(bank.supplyCount > 0);
+        
+        // Train the page predictor on whether the row it kept or closed is
+        // the next one accessed
+        if (channel.trainPage(bank, transaction.row)) stats.pageMispredictionCount += 1;
+        
+        bool is_predicted = policy.page_policy == PAGE_adaptive && bank.supplyCount == 1 &&
+            bank.hitCount + 1 < policy.max_row_hits;
+        bool is_closing = channel.is_closing(bank, bank.supplyCount == 1);
+        CommandType type = transaction.request->is_write ?
+            (is_closing ? COMMAND_write_precharge : COMMAND_write) :
+            (is_closing ? COMMAND_read_precharge : COMMAND_read);
+        if (!addCommand(clock, type, transaction, transaction.request)) continue;
+        scheduler->serve(clock, transaction.request->source % config->nSource);
+        rank.demandCount -= 1;
+        bank.demandCount -= 1;
+        bank.supplyCount -= 1;
+        if (bank.hitCount == 0) stats.rowMissCount += 1; else stats.rowHitCount += 1;
+        bank.hitCount += 1;
+        if (is_closing) {
+            rank.activeCount -= 1;
+            bank.rowBuffer = -1;
+        }
+        if (is_predicted) {
+            bank.pageRow = transaction.row;
+            stats.pagePredictionCount += 1;
+        }
+        
+        removeTransaction(transaction);
+    }
+
+    // Precharge policy
+    for (coordinates.rank = 0; coordinates.rank < spec.nRank(); ++coordinates.rank) {
+        RankData &rank = channel.getRankData(coordinates);
+        
+        // rows stay open in active power-down, and as predicted
+        if (rank.is_sleeping || policy.page_policy == PAGE_adaptive) continue;
+        
+        for (uint64_t banks = channel.getIdleBanks(coordinates); banks; banks &= banks-1) {
+            coordinates.bank = __builtin_ctzll(banks);
+            BankRef bank = channel.getBankRef(coordinates);
+            
+            int64_t idleTime = clock - policy.max_row_idle;
+            if (!addCommand(idleTime, COMMAND_precharge, coordinates, NULL)) continue;
+            rank.activeCount -= 1;
+            bank.rowBuffer = -1;
+        }
+    }
+    
+    // Power down policy
+    for (coordinates.rank = 0; coordinates.rank < spec.nRank(); ++coordinates.rank) {
+        RankData &rank = channel.getRankData(coordinates);
+        
+        if (rank.demandCount > 0 || // rank is serving requests
+            (rank.activeCount > 0 && !policy.powerdown_active) || // rows are open
+            rank.refreshMask != 0 // rank is under refreshing
+        ) {
+            rank.idleTime = -1;
+            continue;
+        }
+        if (rank.idleTime == -1) rank.idleTime = clock;
+        if (rank.is_selfrefreshing) continue;
+        
+        // Self-refresh, out of power-down and with every row closed first
+        if (policy.selfrefresh_idle > 0 && clock >= rank.idleTime + policy.selfrefresh_idle) {
+            if (rank.is_sleeping) {
+                if (!addCommand(clock, COMMAND_powerup, coordinates, NULL)) continue;
+                rank.is_sleeping = false;
+            }
+            for (uint64_t banks = channel.getOpenBanks(coordinates); banks; banks &= banks-1) {
+                coordinates.bank = __builtin_ctzll(banks);
+                BankRef bank = channel.getBankRef(coordinates);
+                
+                if (!addCommand(clock, COMMAND_precharge, coordinates, NULL)) continue;
+                rank.activeCount -= 1;
+                bank.rowBuffer = -1;
+            }
+            if (rank.activeCount > 0) continue;
+            if (!addCommand(clock, COMMAND_selfrefresh_entry, coordinates, NULL)) continue;
+            rank.is_sleeping = true;
+            rank.is_selfrefreshing = true;
+            continue;
+        }
+        
+        if (rank.is_sleeping || clock < rank.idleTime + policy.powerdown_idle) continue;
+        
+        // Power down
+        if (!addCommand(clock, COMMAND_powerdown, coordinates, NULL)) continue;
+        rank.is_sleeping = true;
+    }
+    
+    /** Command retirement */
+    
+    while (!commandQueue.is_empty()) {
+        Command &command = commandQueue.first();
+        
+        if (clock < command.issueTime) break; // in-order
+        
+        switch (command.type) {
+            case COMMAND_read:
+            case COMMAND_read_precharge:
+            case COMMAND_write:
+            case COMMAND_write_precharge:
+                command.request->releaseTime = command.finishTime;
+                releaseWheel.push(command.finishTime, command.request);
+                break;
+                
+            default:
+                break;
+        }
+        
+        commandQueue.shift();
+    }
+    
+    /** Request retirement */
+    
+    while (releaseWheel.pop(clock, released)) {
+        Request &request = *released;
+        
+        /*if (request.is_write) {
+            write_count += 1;
+        } else {
+            read_count += 1;
+            hist[std::min(request.latency()/10, bins)] += 1;
+        }*/
+        if (request.is_write) {
+            stats.writeCount += 1;
+            stats.writeLatency += request.latency();
+        } else {
+            stats.readCount += 1;
+            stats.readLatency += request.latency();
+        }
+        
+        if (listener || completions) {
+            Completion completion = {
+                request.id, request.address, request.allocateTime, request.releaseTime
+            };
+            if (listener) listener->complete(completion);
+            if (completions && !earlyCompletions) queueCompletion(completion);
+        }
+        
+        dataBuffer.remove(request);
+    }
+}
+
+template<class Spec>
+int64_t MemoryController<Spec>::getNextEventTime(int64_t clock)
+{
+    const Timing &timing = spec.timing();
+    const Policy &policy = spec.policy();
+    
+    Coordinates coordinates = {0};
+    int64_t next = INT64_MAX, readyTime;
+    
+    // Request to Transaction
+    if (!requestQueue.is_empty() && !is_full(*requestQueue.first())) {
+        Request &request = *requestQueue.first();
+        next = std::min(next, request.allocateTime + timing.transaction_delay);
+    }
+    
+    // Refresh deadlines, and idle timeouts
+    for (coordinates.rank = 0; coordinates.rank < spec.nRank(); ++coordinates.rank) {
+        RankData &rank = channel.getRankData(coordinates);
+        next = earliest(next, rank.refreshTime, clock);
+        
+        if (rank.idleTime == -1 || rank.is_selfrefreshing) continue;
+        if (!rank.is_sleeping) {
+            next = earliest(next, rank.idleTime + policy.powerdown_idle, clock);
+        }
+        if (policy.selfrefresh_idle > 0) {
+            next = earliest(next, rank.idleTime + policy.selfrefresh_idle, clock);
+        }
+    }
+    
+    // Commands blocked on timing, as issued by the schedule policy ...
+    readyTime = channel.getNextEventTime(clock + timing.command_delay);
+    if (readyTime != INT64_MAX) {
+        next = std::min(next, readyTime - timing.command_delay);
+    }
+    
+    // ... and by the precharge policy, which issues on idle time
+    readyTime = channel.getNextEventTime(clock - policy.max_row_idle + timing.command_delay);
+    if (readyTime != INT64_MAX) {
+        next = std::min(next, readyTime + policy.max_row_idle - timing.command_delay);
+    }
+    
+    // Command retirement
+    if (!commandQueue.is_empty()) {
+        next = std::min(next, commandQueue.first().issueTime);
+    }
+    
+    // Request retirement
+    next = std::min(next, releaseWheel.next());
+    
+    return std::max(next, clock + 1);
+}
+
+template<class Spec>
+void MemoryController<Spec>::getStatistics(Statistics &stats)
+{
+    stats.readCount    += this->stats.readCount;
+    stats.writeCount   += this->stats.writeCount;
+    stats.readLatency  += this->stats.readLatency;
+    stats.writeLatency += this->stats.writeLatency;
+    
+    for (int type=0; type<=COMMAND_selfrefresh_exit; ++type) {
+        stats.commandCount[type] += this->stats.commandCount[type];
+    }
+    stats.turnaroundCount += this->stats.turnaroundCount;
+    stats.rowHitCount     += this->stats.rowHitCount;
+    stats.rowMissCount    += this->stats.rowMissCount;
+    stats.pagePredictionCount    += this->stats.pagePredictionCount;
+    stats.pageMispredictionCount += this->stats.pageMispredictionCount;
+    
+    channel.getStatistics(stats);
+}
+
+template<class Spec>
+bool MemoryController<Spec>::is_idle()
+{
+    return dataBuffer.is_empty() && arrivals.is_empty();
+}
+
+template<class Spec>
+void MemoryController<Spec>::warm(int64_t clock, uint64_t address)
+{
+    assert(is_idle());
+    
+    Coordinates coordinates;
+    decode(config->mapping, address, coordinates);
+    
+    channel.warm(clock, coordinates);
+}
+
+template<class Spec>
+void MemoryController<Spec>::warm(int64_t clock)
+{
+    assert(is_idle());
+    
+    channel.warm(clock);
+}
+
+template<class Spec>
+void MemoryController<Spec>::setListener(Listener *listener)
+{
+    this->listener = listener;
+}
+
+template<class Spec>
+void MemoryController<Spec>::queueCompletion(const Completion &completion)
+{
+    // nothing goes in the ring while older ones wait outside of it
+    if (overflowCount.load(std::memory_order_acquire) > 0 || !completions->push(completion)) {
+        std::lock_guard<std::mutex> lock(overflowLock);
+        overflow.push_back(completion);
+        overflowCount.store(overflow.size(), std::memory_order_release);
+    }
+}
+
+template<class Spec>
+void MemoryController<Spec>::enableCompletions(size_t size, bool early)
+{
+    assert(completions == NULL);
+    
+    earlyCompletions = early;    
+    int error = posix_memalign(&completionMemory, 64, Ring<Completion>::bytes(size));
+    assert(error == 0); (void)error;
+    
+    completions = new Ring<Completion>(completionMemory, size, true);
+}
+
+template<class Spec>
+size_t MemoryController<Spec>::pollCompletions(Completion *completions, size_t count)
+{
+    if (this->completions == NULL) return 0;
+    
+    size_t polled = this->completions->pop(completions, count);
+    
+    // nothing is pushed while completions wait, so once the ring is
+    // drained again they are next in order
+    if (polled < count && overflowCount.load(std::memory_order_acquire) > 0) {
+        polled += this->completions->pop(completions + polled, count - polled);
+        
+        std::lock_guard<std::mutex> lock(overflowLock);
+        for (; polled < count && !overflow.empty(); ++polled) {
+            completions[polled] = overflow.front();
+            overflow.pop_front();
         }
-        
-        // Read / Write
-        assert(bank.rowBuffer == (int)transaction.row);
-        assert(bank.supplyCount > 0);
-        CommandType type = transaction.request->is_write ? COMMAND_write : COMMAND_read;
-        if (!addCommand(clock, type, transaction, transaction.request)) continue;
-        rank.demandCount -= 1;
-        bank.demandCount -= 1;
-        bank.supplyCount -= 1;
-        bank.hitCount += 1;
-        
-        transactionQueue.remove(itq);
+        overflowCount.store(overflow.size(), std::memory_order_release);
     }
+    
+    return polled;
+}
 
-    // Precharge policy
-    for (coordinates.rank = 0; coordinates.rank < config->nRank; ++coordinates.rank) {
-        RankData &rank = channel.getRankData(coordinates);
-        for (coordinates.bank = 0; coordinates.bank < config->nBank; ++coordinates.bank) {
-            BankData &bank = channel.getBankData(coordinates);
-            
-            if (bank.rowBuffer == -1 || bank.demandCount > 0) continue;
-            
-            int64_t idleTime = clock - policy.max_row_idle;
-            if (!addCommand(idleTime, COMMAND_precharge, coordinates, NULL)) continue;
-            rank.activeCount -= 1;
-            bank.rowBuffer = -1;
+/** Checkpoint of a controller's containers, which turns their pointers to
+ *  requests into indices of the data buffer and back. */
+class RequestArchive
+{
+protected:
+    Checkpoint &checkpoint;
+    Request *base;
+    int size;
+
+public:
+    RequestArchive(Checkpoint &_checkpoint, Request *_base, int _size) :
+        checkpoint(_checkpoint),
+        base(_base),
+        size(_size)
+    {
+    }
+    
+    void io(void *data, size_t size) { checkpoint.io(data, size); }
+    template<class DataType>
+    void io(DataType &data) { checkpoint.io(data); }
+    template<class DataType>
+    void expect(DataType value) { checkpoint.expect(value); }
+    bool check(bool is_valid) { return checkpoint.check(is_valid); }
+    
+    template<class DataType>
+    void item(DataType &data) { checkpoint.io(data); }
+    
+    void item(Request *&request) {
+        int32_t index = request && checkpoint.is_saving() ? request - base : -1;
+        checkpoint.io(index);
+        if (!checkpoint.is_saving()) {
+            request = index >= 0 && index < size ? base + index : NULL;
         }
     }
     
-    // Power down policy
-    for (coordinates.rank = 0; coordinates.rank < config->nRank; ++coordinates.rank) {
-        RankData &rank = channel.getRankData(coordinates);
-        
-        if (rank.is_sleeping || 
-            rank.demandCount > 0 || rank.activeCount > 0 || // rank is serving requests
-            clock >= rank.refreshTime // rank is under refreshing
-        ) continue;
-        
-        // Power down
-        if (!addCommand(clock, COMMAND_powerdown, coordinates, NULL)) continue;
-        rank.is_sleeping = true;
+    void item(Transaction &transaction) {
+        checkpoint.io((Coordinates &)transaction);
+        item(transaction.request);
+        checkpoint.io(transaction.is_marked);
     }
     
-    /** Command retirement */
+    void item(Command &command) {
+        checkpoint.io((Coordinates &)command);
+        item(command.request);
+        checkpoint.io(command.type);
+        checkpoint.io(command.issueTime);
+        checkpoint.io(command.finishTime);
+    }
+};
+
+template<class Spec>
+void MemoryController<Spec>::checkpoint(Checkpoint &checkpoint)
+{
+    RequestArchive archive(checkpoint, &dataBuffer[0], dataBuffer.size());
     
-    while (!commandQueue.is_empty()) {
-        Command &command = commandQueue.first();
-        
-        if (clock < command.issueTime) break; // in-order
-        
-        switch (command.type) {
-            case COMMAND_read:
-            case COMMAND_read_precharge:
-            case COMMAND_write:
-            case COMMAND_write_precharge:
-                command.request->releaseTime = command.finishTime;
-                break;
-                
-            default:
-                break;
+    channel.checkpoint(checkpoint);
+    
+    requestQueue.checkpoint(archive);
+    dataBuffer.checkpoint(archive);
+    releaseWheel.checkpoint(archive);
+    transactionQueue.checkpoint(archive);
+    commandQueue.checkpoint(archive);
+    arrivals.checkpoint(archive);
+    
+    size_t words = transactionQueue.words();
+    checkpoint.io(bankMasks, spec.nRank()*spec.nBank()*words*sizeof(uint64_t));
+    checkpoint.io(writeMask, words*sizeof(uint64_t));
+    checkpoint.io(pendingReads);
+    checkpoint.io(pendingWrites);
+    checkpoint.io(is_draining);
+    checkpoint.io(lastDirection);
+    checkpoint.io(sourceMasks, config->nSource*words*sizeof(uint64_t));
+    checkpoint.io(markMask, words*sizeof(uint64_t));
+    scheduler->checkpoint(checkpoint);
+    
+    uint64_t rows = rowMasks.size();
+    checkpoint.io(rows);
+    if (checkpoint.is_saving()) {
+        for (auto &row : rowMasks) {
+            uint64_t key = row.first;
+            checkpoint.io(key);
+            checkpoint.io(&row.second[0], words*sizeof(uint64_t));
+        }
+    } else {
+        rowMasks.clear();
+        for (uint64_t i=0; i<rows && checkpoint.is_ok(); ++i) {
+            uint64_t key;
+            checkpoint.io(key);
+            std::vector<uint64_t> &mask = rowMasks[key];
+            mask.resize(words);
+            checkpoint.io(&mask[0], words*sizeof(uint64_t));
         }
-        
-        commandQueue.shift();
     }
     
-    /** Request retirement */
+    checkpoint.io(stats);
+}
+
+#ifdef __AVX2__
+static inline int64_t maxLanes(__m256i values)
+{
+    int64_t lanes[4] __attribute__((aligned(32)));
+    _mm256_store_si256((__m256i *)lanes, values);
     
-    for (dataBuffer.reset(irq); dataBuffer.next(irq); ) {
-        Request &request = *irq;
-        
-        if (request.releaseTime == -1 || clock < request.releaseTime) continue;
-        
-        /*if (request.is_write) {
-            write_count += 1;
-        } else {
-            read_count += 1;
-            hist[std::min(request.latency()/10, bins)] += 1;
-        }*/
-        
-        dataBuffer.remove(irq);
+    return std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+}
+
+static inline int64_t minLanes(__m256i values)
+{
+    int64_t lanes[4] __attribute__((aligned(32)));
+    _mm256_store_si256((__m256i *)lanes, values);
+    
+    return std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+}
+
+/** Lanes of times later than clock and earlier than next replace next. */
+static inline __m256i earliestLanes(__m256i next, __m256i times, __m256i clock)
+{
+    __m256i earlier = _mm256_and_si256(
+        _mm256_cmpgt_epi64(times, clock), _mm256_cmpgt_epi64(next, times));
+    
+    return _mm256_blendv_epi8(next, times, earlier);
+}
+#endif
+
+/** The latest of time and count more times. */
+static inline int64_t latest(int64_t time, const int64_t *times, size_t count)
+{
+    size_t i = 0;
+#ifdef __AVX2__
+    if (count >= 4) {
+        __m256i max = _mm256_set1_epi64x(time);
+        for (; i+4<=count; i+=4) {
+            __m256i values = _mm256_loadu_si256((const __m256i *)(times + i));
+            max = _mm256_blendv_epi8(max, values, _mm256_cmpgt_epi64(values, max));
+        }
+        time = maxLanes(max);
+    }
+#endif
+    for (; i<count; ++i) {
+        time = std::max(time, times[i]);
+    }
+    
+    return time;
+}
+
+/** Fold the ready times of count banks, kept in four arrays, into the
+ *  earliest one still to come after clock. */
+static inline int64_t earliest(int64_t next, int64_t *const readyTimes[4], size_t count, int64_t clock)
+{
+    size_t i = 0;
+#ifdef __AVX2__
+    if (count >= 4) {
+        // one minimum per array keeps the four chains independent
+        __m256i after = _mm256_set1_epi64x(clock);
+        __m256i next0 = _mm256_set1_epi64x(next), next1 = next0, next2 = next0, next3 = next0;
+        for (; i+4<=count; i+=4) {
+            next0 = earliestLanes(next0, _mm256_loadu_si256((const __m256i *)(readyTimes[0] + i)), after);
+            next1 = earliestLanes(next1, _mm256_loadu_si256((const __m256i *)(readyTimes[1] + i)), after);
+            next2 = earliestLanes(next2, _mm256_loadu_si256((const __m256i *)(readyTimes[2] + i)), after);
+            next3 = earliestLanes(next3, _mm256_loadu_si256((const __m256i *)(readyTimes[3] + i)), after);
+        }
+        next0 = _mm256_blendv_epi8(next0, next1, _mm256_cmpgt_epi64(next0, next1));
+        next2 = _mm256_blendv_epi8(next2, next3, _mm256_cmpgt_epi64(next2, next3));
+        next0 = _mm256_blendv_epi8(next0, next2, _mm256_cmpgt_epi64(next0, next2));
+        next = minLanes(next0);
+    }
+#endif
+    // Times up to clock, -1 included, wrap around to the top, so there is
+    // no branch to mispredict
+    uint64_t after = (uint64_t)clock + 1;
+    uint64_t delta0 = UINT64_MAX, delta1 = UINT64_MAX, delta2 = UINT64_MAX, delta3 = UINT64_MAX;
+    for (; i<count; ++i) {
+        delta0 = std::min(delta0, (uint64_t)readyTimes[0][i] - after);
+        delta1 = std::min(delta1, (uint64_t)readyTimes[1][i] - after);
+        delta2 = std::min(delta2, (uint64_t)readyTimes[2][i] - after);
+        delta3 = std::min(delta3, (uint64_t)readyTimes[3][i] - after);
+    }
+    uint64_t delta = std::min(std::min(delta0, delta1), std::min(delta2, delta3));
+    if (delta < (uint64_t)next - after) {
+        next = after + delta;
+    }
+    
+    return next;
+}
+
+/** Bit i set for each of count values, at most 64, equal to value. */
+static inline uint64_t equalMask(const int32_t *values, size_t count, int32_t value)
+{
+    uint64_t mask = 0;
+    size_t i = 0;
+#ifdef __AVX2__
+    __m256i key = _mm256_set1_epi32(value);
+    for (; i+8<=count; i+=8) {
+        __m256i equal = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)(values + i)), key);
+        mask |= (uint64_t)_mm256_movemask_ps(_mm256_castsi256_ps(equal)) << i;
     }
+#endif
+    for (; i<count; ++i) {
+        mask |= (uint64_t)(values[i] == value) << i;
+    }
+    
+    return mask;
 }
 
-Channel::Channel(Config *_config) :
-    config(_config)
+/** Bytes of whole cache lines holding size bytes. */
+static inline size_t lines(size_t size)
+{
+    return (size + 63)/64*64;
+}
+
+/** Take an array of count elements from a block, on cache lines of its own. */
+template<class DataType>
+static inline DataType *carve(char *&cursor, size_t count)
+{
+    DataType *data = (DataType *)cursor;
+    cursor += lines(count*sizeof(DataType));
+    
+    return data;
+}
+
+template<class Spec>
+Channel<Spec>::Channel(Config *_config) :
+    config(_config),
+    spec(_config)
 {
-    ranks = new Rank*[config->nRank];
-    for (uint32_t i=0; i<config->nRank; ++i) {
-        ranks[i] = new Rank(config);
+    assert(spec.nBank() <= 64);
+    
+    size_t banks = spec.nRank()*spec.nBank(), size = 0;
+    size += 4*lines(banks*sizeof(int32_t)) + 2*lines(banks*sizeof(uint8_t));
+    size += 4*lines(banks*sizeof(int64_t));
+    size += lines(spec.nRank()*sizeof(RankData)) + 4*lines(spec.nRank()*sizeof(int64_t));
+    size += lines(4*spec.nRank()*sizeof(int64_t));
+    
+    int error = posix_memalign(&memory, 64, size);
+    assert(error == 0); (void)error;
+    memset(memory, 0, size);
+    length = size;
+    
+    char *cursor = (char *)memory;
+    bankDemandCount    = carve<int32_t>(cursor, banks);
+    bankSupplyCount    = carve<int32_t>(cursor, banks);
+    bankRowBuffer      = carve<int32_t>(cursor, banks);
+    bankHitCount       = carve<uint8_t>(cursor, banks);
+    bankPageCounter    = carve<uint8_t>(cursor, banks);
+    bankPageRow        = carve<int32_t>(cursor, banks);
+    bankActReadyTime   = carve<int64_t>(cursor, banks);
+    bankPreReadyTime   = carve<int64_t>(cursor, banks);
+    bankReadReadyTime  = carve<int64_t>(cursor, banks);
+    bankWriteReadyTime = carve<int64_t>(cursor, banks);
+    rankData             = carve<RankData>(cursor, spec.nRank());
+    rankActReadyTime     = carve<int64_t>(cursor, spec.nRank());
+    rankFawReadyTime     = carve<int64_t>(cursor, 4*spec.nRank());
+    rankReadReadyTime    = carve<int64_t>(cursor, spec.nRank());
+    rankWriteReadyTime   = carve<int64_t>(cursor, spec.nRank());
+    rankPowerupReadyTime = carve<int64_t>(cursor, spec.nRank());
+    assert(cursor == (char *)memory + size);
+    
+    for (size_t i=0; i<banks; ++i) {
+        bankPageCounter[i]    = 2;
+        bankPageRow[i]        = -1;
+        bankActReadyTime[i]   = 0;
+        bankPreReadyTime[i]   = -1;
+        bankReadReadyTime[i]  = -1;
+        bankWriteReadyTime[i] = -1;
+    }
+    
+    for (uint32_t i=0; i<spec.nRank(); ++i) {
+        rankActReadyTime[i]     = 0;
+        rankFawReadyTime[4*i+0] = 0;
+        rankFawReadyTime[4*i+1] = 0;
+        rankFawReadyTime[4*i+2] = 0;
+        rankFawReadyTime[4*i+3] = 0;
+        rankReadReadyTime[i]    = 0;
+        rankWriteReadyTime[i]   = 0;
+        rankPowerupReadyTime[i] = -1;
     }
     
     rankSelect = -1;
     
+    lastClock = -1;
+    
     anyReadyTime   = 0;
     readReadyTime  = 0;
     writeReadyTime = 0;
@@ -436,27 +2446,68 @@ Channel::Channel(Config *_config) :
     commandBusEnergy = 0;
     addressBusEnergy = 0;
     dataBusEnergy    = 0;
+    
+    actEnergy        = 0;
+    preEnergy        = 0;
+    readEnergy       = 0;
+    writeEnergy      = 0;
+    refreshEnergy    = 0;
+    backgroundEnergy = 0;
+    
+    powerdownCycles   = 0;
+    selfrefreshCycles = 0;
 }
 
-Channel::~Channel()
+template<class Spec>
+Channel<Spec>::~Channel()
 {
-    for (uint32_t i=0; i<config->nRank; ++i) {
-        delete ranks[i];
-    }
-    delete [] ranks;
+    free(memory);
+}
+
+template<class Spec>
+BankRef Channel<Spec>::getBankRef(Coordinates &coordinates)
+{
+    int index = getBankIndex(coordinates);
+    BankRef bank = {
+        bankDemandCount[index], bankSupplyCount[index], bankRowBuffer[index], bankHitCount[index],
+        bankPageCounter[index], bankPageRow[index],
+    };
+    
+    return bank;
+}
+
+template<class Spec>
+RankData &Channel<Spec>::getRankData(Coordinates &coordinates)
+{
+    return rankData[coordinates.rank];
 }
 
-BankData &Channel::getBankData(Coordinates &coordinates)
+template<class Spec>
+uint64_t Channel<Spec>::getOpenBanks(Coordinates &coordinates)
 {
-    return ranks[coordinates.rank]->getBankData(coordinates);
+    int index = coordinates.rank*spec.nBank();
+    
+    return ~equalMask(&bankRowBuffer[index], spec.nBank(), -1) & (~(uint64_t)0 >> (64 - spec.nBank()));
+}
+
+template<class Spec>
+uint64_t Channel<Spec>::getIdleBanks(Coordinates &coordinates)
+{
+    int index = coordinates.rank*spec.nBank();
+    
+    return getOpenBanks(coordinates) & equalMask(&bankDemandCount[index], spec.nBank(), 0);
 }
 
-RankData &Channel::getRankData(Coordinates &coordinates)
+template<class Spec>
+uint64_t Channel<Spec>::getBusyBanks(Coordinates &coordinates)
 {
-    return ranks[coordinates.rank]->getRankData(coordinates);
+    int index = coordinates.rank*spec.nBank();
+    
+    return ~equalMask(&bankDemandCount[index], spec.nBank(), 0) & (~(uint64_t)0 >> (64 - spec.nBank()));
 }
 
-int64_t Channel::getReadyTime(CommandType type, Coordinates &coordinates)
+template<class Spec>
+int64_t Channel<Spec>::getReadyTime(CommandType type, Coordinates &coordinates)
 {
     int64_t clock;
     
@@ -464,14 +2515,16 @@ int64_t Channel::getReadyTime(CommandType type, Coordinates &coordinates)
         case COMMAND_activate:
         case COMMAND_precharge:
         case COMMAND_refresh:
-            clock = ranks[coordinates.rank]->getReadyTime(type, coordinates);
+        case COMMAND_refresh_bank:
+        case COMMAND_selfrefresh_entry:
+            clock = getRankReadyTime(type, coordinates);
             clock = std::max(clock, anyReadyTime);
             
             return clock;
             
         case COMMAND_read:
         case COMMAND_read_precharge:
-            clock = ranks[coordinates.rank]->getReadyTime(type, coordinates);
+            clock = getRankReadyTime(type, coordinates);
             clock = std::max(clock, anyReadyTime);
             if (rankSelect != coordinates.rank) {
                 clock = std::max(clock, readReadyTime);
@@ -481,7 +2534,7 @@ int64_t Channel::getReadyTime(CommandType type, Coordinates &coordinates)
             
         case COMMAND_write:
         case COMMAND_write_precharge:
-            clock = ranks[coordinates.rank]->getReadyTime(type, coordinates);
+            clock = getRankReadyTime(type, coordinates);
             clock = std::max(clock, anyReadyTime);
             if (rankSelect != coordinates.rank) {
                 clock = std::max(clock, writeReadyTime);
@@ -491,7 +2544,8 @@ int64_t Channel::getReadyTime(CommandType type, Coordinates &coordinates)
             
         case COMMAND_powerup:
         case COMMAND_powerdown:
-            clock = ranks[coordinates.rank]->getReadyTime(type, coordinates);
+        case COMMAND_selfrefresh_exit:
+            clock = getRankReadyTime(type, coordinates);
             
             return clock;
             
@@ -501,15 +2555,18 @@ int64_t Channel::getReadyTime(CommandType type, Coordinates &coordinates)
     }
 }
 
-int64_t Channel::getFinishTime(int64_t clock, CommandType type, Coordinates &coordinates)
+template<class Spec>
+int64_t Channel<Spec>::getFinishTime(int64_t clock, CommandType type, Coordinates &coordinates)
 {
-    ChannelTiming &timing = config->timing.channel;
+    const ChannelTiming &timing = spec.timing().channel;
     Energy &energy = config->energy;
     
     switch (type) {
         case COMMAND_activate:
         case COMMAND_precharge:
         case COMMAND_refresh:
+        case COMMAND_refresh_bank:
+        case COMMAND_selfrefresh_entry:
             anyReadyTime = clock + timing.any_to_any;
             if (type == COMMAND_activate) {
                 anyReadyTime = std::max(anyReadyTime, clock + timing.act_to_any);
@@ -519,7 +2576,7 @@ int64_t Channel::getFinishTime(int64_t clock, CommandType type, Coordinates &coo
             if (type == COMMAND_activate) {
                 addressBusEnergy += energy.row_address_bus;
             }
-            return ranks[coordinates.rank]->getFinishTime(clock, type, coordinates);
+            return getRankFinishTime(clock, type, coordinates);
             
         case COMMAND_read:
         case COMMAND_read_precharge:
@@ -533,7 +2590,7 @@ int64_t Channel::getFinishTime(int64_t clock, CommandType type, Coordinates &coo
             
             rankSelect = coordinates.rank;
             
-            return ranks[coordinates.rank]->getFinishTime(clock, type, coordinates);
+            return getRankFinishTime(clock, type, coordinates);
             
         case COMMAND_write:
         case COMMAND_write_precharge:
@@ -547,11 +2604,12 @@ int64_t Channel::getFinishTime(int64_t clock, CommandType type, Coordinates &coo
             
             rankSelect = coordinates.rank;
             
-            return ranks[coordinates.rank]->getFinishTime(clock, type, coordinates);
+            return getRankFinishTime(clock, type, coordinates);
             
         case COMMAND_powerup:
         case COMMAND_powerdown:
-            return ranks[coordinates.rank]->getFinishTime(clock, type, coordinates);
+        case COMMAND_selfrefresh_exit:
+            return getRankFinishTime(clock, type, coordinates);
             
         default:
             assert(0);
@@ -559,101 +2617,271 @@ int64_t Channel::getFinishTime(int64_t clock, CommandType type, Coordinates &coo
     }
 }
 
-void Channel::cycle(int64_t clock)
+template<class Spec>
+int64_t Channel<Spec>::getNextEventTime(int64_t clock)
 {
-    Energy &energy = config->energy;
+    int64_t next = INT64_MAX;
     
-    clockEnergy += energy.clock_per_cycle;
+    next = earliest(next, anyReadyTime, clock);
+    next = earliest(next, readReadyTime, clock);
+    next = earliest(next, writeReadyTime, clock);
     
-    for (uint8_t rank=0; rank<config->nRank; ++rank) {
-        ranks[rank]->cycle(clock);
+    for (uint32_t rank=0; rank<spec.nRank(); ++rank) {
+        next = earliest(next, rankActReadyTime[rank], clock);
+        next = earliest(next, rankFawReadyTime[4*rank], clock);
+        next = earliest(next, rankReadReadyTime[rank], clock);
+        next = earliest(next, rankWriteReadyTime[rank], clock);
+        next = earliest(next, rankPowerupReadyTime[rank], clock);
     }
+    
+    int64_t *const bankReadyTimes[4] = {
+        bankActReadyTime, bankPreReadyTime, bankReadReadyTime, bankWriteReadyTime,
+    };
+    next = earliest(next, bankReadyTimes, spec.nRank()*spec.nBank(), clock);
+    
+    return next;
 }
 
-Rank::Rank(Config *_config) :
-    config(_config)
+/** Whether the next column access to the open row of bank closes it,
+ *  with auto-precharge, by the page policy. */
+template<class Spec>
+bool Channel<Spec>::is_closing(BankRef &bank, bool is_last)
 {
-    banks = new Bank*[config->nBank];
-    for (uint32_t i=0; i<config->nBank; ++i) {
-        banks[i] = new Bank(config);
+    const Policy &policy = spec.policy();
+    
+    switch (policy.page_policy) {
+        case PAGE_close:
+            return true;
+        
+        case PAGE_hybrid:
+            // no other hit pending, or the row is precharged after this one anyway
+            return is_last || bank.hitCount + 1 >= policy.max_row_hits;
+        
+        case PAGE_adaptive:
+            // as hybrid, unless the row is predicted to be hit next
+            if (bank.hitCount + 1 >= policy.max_row_hits) return true;
+            return is_last && bank.pageCounter < 2;
+        
+        default:
+            return false;
     }
+}
+
+template<class Spec>
+bool Channel<Spec>::trainPage(BankRef &bank, int32_t row)
+{
+    if (bank.pageRow == -1) return false;
     
-    actReadyTime     = 0;
-    fawReadyTime[0]  = 0;
-    fawReadyTime[1]  = 0;
-    fawReadyTime[2]  = 0;
-    fawReadyTime[3]  = 0;
-    readReadyTime    = 0;
-    writeReadyTime   = 0;
-    powerupReadyTime = -1;
+    bool is_hit = bank.pageRow == row;
+    bool is_wrong = is_hit != (bank.pageCounter >= 2);
+    if (is_hit && bank.pageCounter < 3) bank.pageCounter += 1;
+    if (!is_hit && bank.pageCounter > 0) bank.pageCounter -= 1;
+    bank.pageRow = -1;
     
-    actEnergy        = 0;
-    preEnergy        = 0;
-    readEnergy       = 0;
-    writeEnergy      = 0;
-    refreshEnergy    = 0;
-    backgroundEnergy = 0;
+    return is_wrong;
 }
 
-Rank::~Rank()
+template<class Spec>
+void Channel<Spec>::warmRefresh(int64_t clock, uint8_t rank)
 {
-    for (uint32_t i=0; i<config->nBank; ++i) {
-        delete banks[i];
+    RankData &data = rankData[rank];
+    int64_t interval = getRefreshInterval();
+    
+    if (clock < data.refreshTime) return;
+    
+    // each refresh closes every row of its banks, so only how many were
+    // due matters, up to one per bank
+    int64_t count = (clock - data.refreshTime)/interval + 1;
+    int nBank = spec.nBank();
+    int banks = spec.policy().refresh_per_bank ? (int)std::min(count, (int64_t)nBank) : nBank;
+    for (int i=0; i<banks; ++i) {
+        int index = rank*nBank + (data.refreshBank + i) % nBank;
+        if (bankRowBuffer[index] == -1) continue;
+        
+        bankRowBuffer[index]      = -1;
+        bankActReadyTime[index]   = clock;
+        bankPreReadyTime[index]   = -1;
+        bankReadReadyTime[index]  = -1;
+        bankWriteReadyTime[index] = -1;
+        data.activeCount -= 1;
     }
-    delete [] banks;
+    if (spec.policy().refresh_per_bank) {
+        data.refreshBank = (data.refreshBank + count) % nBank;
+    }
+    data.refreshMask = 0;
+    
+    data.refreshTime += count*interval;
 }
 
-BankData &Rank::getBankData(Coordinates &coordinates)
+template<class Spec>
+void Channel<Spec>::warm(int64_t clock)
 {
-    return banks[coordinates.bank]->getBankData(coordinates);
+    for (uint32_t rank=0; rank<spec.nRank(); ++rank) {
+        warmRefresh(clock, rank);
+    }
 }
 
-RankData &Rank::getRankData(Coordinates &coordinates)
+template<class Spec>
+void Channel<Spec>::warm(int64_t clock, Coordinates &coordinates)
 {
-    return data;
+    const Policy &policy = spec.policy();
+    
+    uint8_t rank = coordinates.rank;
+    int index = getBankIndex(coordinates);
+    RankData &data = rankData[rank];
+    
+    warmRefresh(clock, rank);
+    
+    // Power up
+    if (data.is_sleeping) {
+        data.is_sleeping = false;
+        data.is_selfrefreshing = false;
+        
+        rankActReadyTime[rank]     = clock;
+        rankFawReadyTime[4*rank+0] = clock;
+        rankFawReadyTime[4*rank+1] = clock;
+        rankFawReadyTime[4*rank+2] = clock;
+        rankFawReadyTime[4*rank+3] = clock;
+        rankPowerupReadyTime[rank] = -1;
+    }
+    
+    // Precharge, if the row has been idle for long, as the last access
+    // is kept in preReadyTime
+    int32_t &rowBuffer = bankRowBuffer[index];
+    if (rowBuffer != -1 && clock - bankPreReadyTime[index] > policy.max_row_idle &&
+        policy.page_policy != PAGE_adaptive) {
+        data.activeCount -= 1;
+        rowBuffer = -1;
+    }
+    
+    // Activate, unless the row is open and may be hit again
+    if (rowBuffer != (int)coordinates.row || bankHitCount[index] >= policy.max_row_hits) {
+        if (rowBuffer == -1) data.activeCount += 1;
+        rowBuffer = coordinates.row;
+        bankHitCount[index] = 0;
+    }
+    
+    // Read / Write, the last hit pending as nothing is queued
+    BankRef bank = getBankRef(coordinates);
+    trainPage(bank, coordinates.row);
+    bool is_predicted = policy.page_policy == PAGE_adaptive && bank.hitCount + 1 < policy.max_row_hits;
+    bool is_closing = this->is_closing(bank, true);
+    bankHitCount[index] += 1;
+    if (is_predicted) bank.pageRow = coordinates.row;
+    
+    bankActReadyTime[index]   = -1;
+    bankPreReadyTime[index]   = clock;
+    bankReadReadyTime[index]  = clock;
+    bankWriteReadyTime[index] = clock;
+    
+    // Auto-precharge
+    if (is_closing) {
+        data.activeCount -= 1;
+        rowBuffer = -1;
+        
+        bankActReadyTime[index]   = clock;
+        bankPreReadyTime[index]   = -1;
+        bankReadReadyTime[index]  = -1;
+        bankWriteReadyTime[index] = -1;
+    }
+}
+
+template<class Spec>
+void Channel<Spec>::cycle(int64_t clock)
+{
+    Energy &energy = config->energy;
+    
+    // account for the cycles skipped since the last call
+    int64_t cycles = clock - lastClock;
+    lastClock = clock;
+    
+    clockEnergy += energy.clock_per_cycle*cycles;
+    
+    for (uint32_t rank=0; rank<spec.nRank(); ++rank) {
+        RankData &data = rankData[rank];
+        
+        if (rankPowerupReadyTime[rank] == -1) {
+            backgroundEnergy += energy.powerup_per_cycle*cycles;
+        } else if (data.is_selfrefreshing) {
+            backgroundEnergy += energy.selfrefresh_per_cycle*cycles;
+            selfrefreshCycles += cycles;
+        } else if (data.activeCount > 0) {
+            backgroundEnergy += energy.active_powerdown_per_cycle*cycles;
+            powerdownCycles += cycles;
+        } else {
+            backgroundEnergy += energy.powerdown_per_cycle*cycles;
+            powerdownCycles += cycles;
+        }
+    }
+}
+
+template<class Spec>
+void Channel<Spec>::getStatistics(Statistics &stats)
+{
+    stats.clockEnergy      += clockEnergy;
+    stats.commandBusEnergy += commandBusEnergy;
+    stats.addressBusEnergy += addressBusEnergy;
+    stats.dataBusEnergy    += dataBusEnergy;
+    
+    stats.actEnergy        += actEnergy;
+    stats.preEnergy        += preEnergy;
+    stats.readEnergy       += readEnergy;
+    stats.writeEnergy      += writeEnergy;
+    stats.refreshEnergy    += refreshEnergy;
+    stats.backgroundEnergy += backgroundEnergy;
+    
+    stats.powerdownCycles   += powerdownCycles;
+    stats.selfrefreshCycles += selfrefreshCycles;
 }
 
-int64_t Rank::getReadyTime(CommandType type, Coordinates &coordinates)
+template<class Spec>
+int64_t Channel<Spec>::getRankReadyTime(CommandType type, Coordinates &coordinates)
 {
+    uint8_t rank = coordinates.rank;
+    int index = getBankIndex(coordinates);
     int64_t clock;
     
     switch (type) {
         case COMMAND_activate:
-            clock = banks[coordinates.bank]->getReadyTime(type, coordinates);
-            clock = std::max(clock, actReadyTime);
-            clock = std::max(clock, fawReadyTime[0]);
+            clock = getBankReadyTime(type, index);
+            clock = std::max(clock, rankActReadyTime[rank]);
+            clock = std::max(clock, rankFawReadyTime[4*rank]);
             
             return clock;
             
         case COMMAND_precharge:
-            clock = banks[coordinates.bank]->getReadyTime(type, coordinates);
+            clock = getBankReadyTime(type, index);
             
             return clock;
             
         case COMMAND_read:
         case COMMAND_read_precharge:
-            clock = banks[coordinates.bank]->getReadyTime(type, coordinates);
-            clock = std::max(clock, readReadyTime);
+            clock = getBankReadyTime(type, index);
+            clock = std::max(clock, rankReadReadyTime[rank]);
             
             return clock;
             
         case COMMAND_write:
         case COMMAND_write_precharge:
-            clock = banks[coordinates.bank]->getReadyTime(type, coordinates);
-            clock = std::max(clock, writeReadyTime);
+            clock = getBankReadyTime(type, index);
+            clock = std::max(clock, rankWriteReadyTime[rank]);
             
             return clock;
             
         case COMMAND_refresh:
-            clock = actReadyTime;
-            for (uint8_t i=0; i<config->nBank; ++i) {
-                clock = std::max(clock, banks[i]->getReadyTime(COMMAND_activate, coordinates));
-            }
+        case COMMAND_selfrefresh_entry:
+            // every bank is precharged by now
+            clock = latest(rankActReadyTime[rank], &bankActReadyTime[rank*spec.nBank()], spec.nBank());
             
             return clock;
             
+        case COMMAND_refresh_bank:
+            // the bank is precharged by now
+            return getBankReadyTime(COMMAND_activate, index);
+        
         case COMMAND_powerup:
-            return powerupReadyTime;
+        case COMMAND_selfrefresh_exit:
+            return rankPowerupReadyTime[rank];
             
         case COMMAND_powerdown:
             return 0;
@@ -664,14 +2892,19 @@ int64_t Rank::getReadyTime(CommandType type, Coordinates &coordinates)
     }
 }
 
-int64_t Rank::getFinishTime(int64_t clock, CommandType type, Coordinates &coordinates)
+template<class Spec>
+int64_t Channel<Spec>::getRankFinishTime(int64_t clock, CommandType type, Coordinates &coordinates)
 {
-    RankTiming &timing = config->timing.rank;
+    const RankTiming &timing = spec.timing().rank;
     Energy &energy = config->energy;
     
+    uint8_t rank = coordinates.rank;
+    int index = getBankIndex(coordinates);
+    int64_t *fawReadyTime = &rankFawReadyTime[4*rank];
+    
     switch (type) {
         case COMMAND_activate:
-            actReadyTime = clock + timing.act_to_act;
+            rankActReadyTime[rank] = clock + timing.act_to_act;
             
             fawReadyTime[0] = fawReadyTime[1];
             fawReadyTime[1] = fawReadyTime[2];
@@ -680,62 +2913,95 @@ int64_t Rank::getFinishTime(int64_t clock, CommandType type, Coordinates &coordi
             
             actEnergy += energy.act;
             
-            return banks[coordinates.bank]->getFinishTime(clock, type, coordinates);
+            return getBankFinishTime(clock, type, index);
             
         case COMMAND_precharge:
-            return banks[coordinates.bank]->getFinishTime(clock, type, coordinates);
+            return getBankFinishTime(clock, type, index);
             
         case COMMAND_read:
         case COMMAND_read_precharge:
-            readReadyTime  = clock + timing.read_to_read;
-            writeReadyTime = clock + timing.read_to_write;
+            rankReadReadyTime[rank]  = clock + timing.read_to_read;
+            rankWriteReadyTime[rank] = clock + timing.read_to_write;
             
             readEnergy += energy.read;
             
-            return banks[coordinates.bank]->getFinishTime(clock, type, coordinates);
+            return getBankFinishTime(clock, type, index);
             
         case COMMAND_write:
         case COMMAND_write_precharge:
-            readReadyTime  = clock + timing.write_to_read;
-            writeReadyTime = clock + timing.write_to_write;
+            rankReadReadyTime[rank]  = clock + timing.write_to_read;
+            rankWriteReadyTime[rank] = clock + timing.write_to_write;
             
             writeEnergy += energy.write;
             
-            return banks[coordinates.bank]->getFinishTime(clock, type, coordinates);
+            return getBankFinishTime(clock, type, index);
         
         case COMMAND_refresh:
-            actReadyTime = clock + timing.refresh_latency;
+            rankActReadyTime[rank] = clock + timing.refresh_latency;
             
-            fawReadyTime[0] = actReadyTime;
-            fawReadyTime[1] = actReadyTime;
-            fawReadyTime[2] = actReadyTime;
-            fawReadyTime[3] = actReadyTime;
+            fawReadyTime[0] = rankActReadyTime[rank];
+            fawReadyTime[1] = rankActReadyTime[rank];
+            fawReadyTime[2] = rankActReadyTime[rank];
+            fawReadyTime[3] = rankActReadyTime[rank];
             
             refreshEnergy += energy.refresh;
             
             return clock;
+        
+        case COMMAND_refresh_bank:
+            // other banks go on meanwhile
+            bankActReadyTime[index] = clock + timing.refresh_bank_latency;
+            
+            refreshEnergy += energy.refresh_bank;
+            
+            return clock;
             
         case COMMAND_powerup:
-            actReadyTime = clock + timing.powerup_latency;
+            rankActReadyTime[rank] = clock + timing.powerup_latency;
             
-            fawReadyTime[0] = actReadyTime;
-            fawReadyTime[1] = actReadyTime;
-            fawReadyTime[2] = actReadyTime;
-            fawReadyTime[3] = actReadyTime;
+            fawReadyTime[0] = rankActReadyTime[rank];
+            fawReadyTime[1] = rankActReadyTime[rank];
+            fawReadyTime[2] = rankActReadyTime[rank];
+            fawReadyTime[3] = rankActReadyTime[rank];
             
-            powerupReadyTime = -1;
+            rankPowerupReadyTime[rank] = -1;
             
             return clock;
             
         case COMMAND_powerdown:
-            actReadyTime = -1;
+            rankActReadyTime[rank] = -1;
+            
+            fawReadyTime[0] = rankActReadyTime[rank];
+            fawReadyTime[1] = rankActReadyTime[rank];
+            fawReadyTime[2] = rankActReadyTime[rank];
+            fawReadyTime[3] = rankActReadyTime[rank];
+            
+            rankPowerupReadyTime[rank] = clock + timing.powerdown_latency;
+            
+            return clock;
+        
+        case COMMAND_selfrefresh_entry:
+            // the rank refreshes itself until it exits
+            rankActReadyTime[rank] = -1;
+            
+            fawReadyTime[0] = rankActReadyTime[rank];
+            fawReadyTime[1] = rankActReadyTime[rank];
+            fawReadyTime[2] = rankActReadyTime[rank];
+            fawReadyTime[3] = rankActReadyTime[rank];
+            
+            rankPowerupReadyTime[rank] = clock + timing.selfrefresh_latency;
             
-            fawReadyTime[0] = actReadyTime;
-            fawReadyTime[1] = actReadyTime;
-            fawReadyTime[2] = actReadyTime;
-            fawReadyTime[3] = actReadyTime;
+            return clock;
+        
+        case COMMAND_selfrefresh_exit:
+            rankActReadyTime[rank] = clock + timing.selfrefresh_exit_latency;
             
-            powerupReadyTime = clock + timing.powerdown_latency;
+            fawReadyTime[0] = rankActReadyTime[rank];
+            fawReadyTime[1] = rankActReadyTime[rank];
+            fawReadyTime[2] = rankActReadyTime[rank];
+            fawReadyTime[3] = rankActReadyTime[rank];
+            
+            rankPowerupReadyTime[rank] = -1;
             
             return clock;
             
@@ -745,58 +3011,31 @@ int64_t Rank::getFinishTime(int64_t clock, CommandType type, Coordinates &coordi
     }
 }
 
-void Rank::cycle(int64_t clock)
-{
-    Energy &energy = config->energy;
-    
-    if (powerupReadyTime == -1)
-        backgroundEnergy += energy.powerup_per_cycle;
-    else
-        backgroundEnergy += energy.powerdown_per_cycle;
-}
-
-Bank::Bank(Config *_config) :
-    config(_config)
-{
-    actReadyTime   = 0;
-    preReadyTime   = -1;
-    readReadyTime  = -1;
-    writeReadyTime = -1;
-}
-
-Bank::~Bank()
-{
-}
-
-BankData &Bank::getBankData(Coordinates &coordinates)
-{
-    return data;
-}
-
-int64_t Bank::getReadyTime(CommandType type, Coordinates &coordinates)
+template<class Spec>
+int64_t Channel<Spec>::getBankReadyTime(CommandType type, int index)
 {
     switch (type) {
         case COMMAND_activate:
-            assert(actReadyTime != -1);
+            assert(bankActReadyTime[index] != -1);
             
-            return actReadyTime;
+            return bankActReadyTime[index];
             
         case COMMAND_precharge:
-            assert(preReadyTime != -1);
+            assert(bankPreReadyTime[index] != -1);
             
-            return preReadyTime;
+            return bankPreReadyTime[index];
             
         case COMMAND_read:
         case COMMAND_read_precharge:
-            assert(readReadyTime != -1);
+            assert(bankReadReadyTime[index] != -1);
             
-            return readReadyTime;
+            return bankReadReadyTime[index];
             
         case COMMAND_write:
         case COMMAND_write_precharge:
-            assert(writeReadyTime != -1);
+            assert(bankWriteReadyTime[index] != -1);
             
-            return writeReadyTime;
+            return bankWriteReadyTime[index];
             
         //case COMMAND_refresh:
         //case COMMAND_powerup:
@@ -808,9 +3047,15 @@ int64_t Bank::getReadyTime(CommandType type, Coordinates &coordinates)
     }
 }
 
-int64_t Bank::getFinishTime(int64_t clock, CommandType type, Coordinates &coordinates)
+template<class Spec>
+int64_t Channel<Spec>::getBankFinishTime(int64_t clock, CommandType type, int index)
 {
-    BankTiming &timing = config->timing.bank;
+    const BankTiming &timing = spec.timing().bank;
+    
+    int64_t &actReadyTime   = bankActReadyTime[index];
+    int64_t &preReadyTime   = bankPreReadyTime[index];
+    int64_t &readReadyTime  = bankReadReadyTime[index];
+    int64_t &writeReadyTime = bankWriteReadyTime[index];
     
     switch (type) {
         case COMMAND_activate:
@@ -846,7 +3091,7 @@ int64_t Bank::getFinishTime(int64_t clock, CommandType type, Coordinates &coordi
                 // see rank for readReadyTime
                 // see rank for writeReadyTime
             } else {
-                actReadyTime   = clock + timing.read_to_pre + timing.pre_to_act;
+                actReadyTime   = std::max(preReadyTime, clock + timing.read_to_pre) + timing.pre_to_act;
                 preReadyTime   = -1;
                 readReadyTime  = -1;
                 writeReadyTime = -1;
@@ -865,7 +3110,7 @@ int64_t Bank::getFinishTime(int64_t clock, CommandType type, Coordinates &coordi
                 // see rank for readReadyTime
                 // see rank for writeReadyTime
             } else {
-                actReadyTime   = clock + timing.write_to_pre + timing.pre_to_act;
+                actReadyTime   = std::max(preReadyTime, clock + timing.write_to_pre) + timing.pre_to_act;
                 preReadyTime   = -1;
                 readReadyTime  = -1;
                 writeReadyTime = -1;
@@ -882,3 +3127,32 @@ int64_t Bank::getFinishTime(int64_t clock, CommandType type, Coordinates &coordi
             return -1;
     }
 }
+
+template<class Spec>
+void Channel<Spec>::checkpoint(Checkpoint &checkpoint)
+{
+    checkpoint.expect(length);
+    checkpoint.io(memory, length);
+    
+    checkpoint.io(rankSelect);
+    checkpoint.io(lastClock);
+    
+    checkpoint.io(anyReadyTime);
+    checkpoint.io(readReadyTime);
+    checkpoint.io(writeReadyTime);
+    
+    checkpoint.io(clockEnergy);
+    checkpoint.io(commandBusEnergy);
+    checkpoint.io(addressBusEnergy);
+    checkpoint.io(dataBusEnergy);
+    
+    checkpoint.io(actEnergy);
+    checkpoint.io(preEnergy);
+    checkpoint.io(readEnergy);
+    checkpoint.io(writeEnergy);
+    checkpoint.io(refreshEnergy);
+    checkpoint.io(backgroundEnergy);
+    
+    checkpoint.io(powerdownCycles);
+    checkpoint.io(selfrefreshCycles);
+}
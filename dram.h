@@ -1,18 +1,39 @@
+#include "checkpoint.h"
 #include "configure.h"
 #include "container.h"
 #include "memory.h"
+#include "ring.h"
+#include "thread.h"
+#include <deque>
 #include <ostream>
+#include <unordered_map>
+#include <vector>
 
 namespace DRAM {
 
 using namespace Memory;
 
+/** Where the coordinates sit in an address. The channel and bank may be
+ *  hashed by XORing in other address bits, so that strides landing on
+ *  one bank or channel spread over all of them. */
 struct AddressMapping {
     BitField channel;
     BitField rank;
     BitField bank;
     BitField row;
     BitField column;
+    
+    /** Bits XORed into the channel and bank; zero wide if not hashed. */
+    BitField channelHash;
+    BitField bankHash;
+    
+    uint8_t channelOf(uint64_t address) {
+        return channel.value(address) ^ channelHash.value(address);
+    }
+    
+    uint8_t bankOf(uint64_t address) {
+        return bank.value(address) ^ bankHash.value(address);
+    }
 };
 
 struct ChannelTiming {
@@ -34,9 +55,12 @@ struct RankTiming {
     
     uint32_t refresh_latency;
     uint32_t refresh_interval;
+    uint32_t refresh_bank_latency; /**< Of a per-bank refresh, which blocks that bank alone. */
     
     uint32_t powerdown_latency;
     uint32_t powerup_latency;
+    uint32_t selfrefresh_latency; /**< Least stay in self-refresh, tCKESR. */
+    uint32_t selfrefresh_exit_latency; /**< From self-refresh exit to a command, tXS. */
 };
 
 struct BankTiming {
@@ -60,6 +84,58 @@ struct Timing {
     BankTiming bank;
 };
 
+/** Device timing parameters in cycles, from which a Timing derives. */
+struct TimingParameters {
+    int tTQ, tCQ, tCMD, tRCMD;
+    int tCL, tCWL, tAL, tBL;
+    int tRAS, tRCD, tRRD, tRP;
+    int tCCD, tRTP, tWTR, tWR, tRTRS;
+    int tRFC, tREFI, tFAW, tCKE, tXP;
+    int tRFCpb, tCKESR, tXS;
+};
+
+constexpr Timing deriveTiming(const TimingParameters &p)
+{
+    Timing timing = {};
+    
+    timing.transaction_delay = p.tTQ;
+    timing.command_delay     = p.tCQ;
+    
+    timing.channel.any_to_any     = p.tCMD;
+    timing.channel.act_to_any     = p.tRCMD;
+    timing.channel.read_to_read   = p.tBL+p.tRTRS;
+    timing.channel.read_to_write  = p.tCL+p.tBL+p.tRTRS-p.tCWL;
+    timing.channel.write_to_read  = p.tCWL+p.tBL+p.tRTRS-p.tCL;
+    timing.channel.write_to_write = p.tBL+p.tRTRS;
+    
+    timing.rank.act_to_act     = p.tRRD;
+    timing.rank.act_to_faw     = p.tFAW;
+    timing.rank.read_to_read   = std::max(p.tBL, p.tCCD);
+    timing.rank.read_to_write  = p.tCL+p.tBL+p.tRTRS-p.tCWL; // double check
+    timing.rank.write_to_read  = p.tCWL+p.tBL+p.tWTR; // double check
+    timing.rank.write_to_write = std::max(p.tBL, p.tCCD);
+    
+    timing.rank.refresh_latency  = p.tRFC;
+    timing.rank.refresh_interval = p.tREFI;
+    timing.rank.refresh_bank_latency = p.tRFCpb;
+    
+    timing.rank.powerdown_latency = p.tCKE; // double check
+    timing.rank.powerup_latency   = p.tXP; // double check
+    timing.rank.selfrefresh_latency      = p.tCKESR;
+    timing.rank.selfrefresh_exit_latency = p.tXS;
+    
+    timing.bank.act_to_read   = p.tRCD-p.tAL + p.tRCMD-p.tCMD;
+    timing.bank.act_to_write  = p.tRCD-p.tAL + p.tRCMD-p.tCMD;
+    timing.bank.act_to_pre    = p.tRAS + p.tRCMD-p.tCMD;
+    timing.bank.read_to_pre   = p.tAL+p.tBL+std::max(p.tRTP, p.tCCD)-p.tCCD; // double check
+    timing.bank.write_to_pre  = p.tAL+p.tCWL+p.tBL+p.tWR; // double check
+    timing.bank.pre_to_act    = p.tRP;
+    timing.bank.read_to_data  = p.tAL+p.tCL + 5;
+    timing.bank.write_to_data = p.tAL+p.tCWL + 5;
+    
+    return timing;
+}
+
 struct Energy {
     uint32_t clock_per_cycle;
     uint32_t command_bus;
@@ -71,14 +147,64 @@ struct Energy {
     uint32_t read;
     uint32_t write;
     uint32_t refresh;
+    uint32_t refresh_bank;
     
     uint32_t powerup_per_cycle;
-    uint32_t powerdown_per_cycle;
+    uint32_t powerdown_per_cycle; /**< Precharge power-down. */
+    uint32_t active_powerdown_per_cycle;
+    uint32_t selfrefresh_per_cycle;
+};
+
+/** When rows close after column accesses. */
+enum PagePolicy {
+    PAGE_open, /**< rows stay open, until max_row_idle or max_row_hits */
+    PAGE_close, /**< every access closes its row, with auto-precharge */
+    PAGE_hybrid, /**< the last pending hit, or the max_row_hits one, closes the row */
+    PAGE_adaptive, /**< as hybrid, but a bank predicted to hit the row next keeps it open */
 };
 
 struct Policy {
     uint8_t max_row_idle;
     uint8_t max_row_hits;
+    uint8_t page_policy; /**< A PagePolicy. */
+    
+    /** Writes wait until write_high of them are pending, or no read is,
+     *  and then go on their own until write_low are left; 0 to schedule
+     *  reads and writes together. */
+    uint32_t write_high;
+    uint32_t write_low;
+    
+    /** Refreshes that may fall behind while the rank has work, and that may
+     *  go ahead while it has none, up to 8 each as JEDEC allows; counted in
+     *  per-bank refreshes if refresh_per_bank. */
+    uint8_t refresh_postpone;
+    uint8_t refresh_pullin;
+    /** Refresh one bank at a time, nBank times per tREFI, in turn. */
+    bool refresh_per_bank;
+    
+    /** Power down with rows open, in active power-down, rather than only
+     *  once they have all closed. */
+    bool powerdown_active;
+    /** Cycles a rank idles before it powers down, 0 for at once, and
+     *  before it enters self-refresh instead, 0 for never. */
+    uint32_t powerdown_idle;
+    uint32_t selfrefresh_idle;
+};
+
+/** Schedulers of transactions among sources. */
+enum SchedulerType {
+    SCHEDULER_frfcfs, /**< oldest first, row hits before misses */
+    SCHEDULER_parbs, /**< PAR-BS: batches of the oldest first, shortest sources first */
+    SCHEDULER_atlas, /**< ATLAS: sources that got the least service first */
+    SCHEDULER_bliss, /**< BLISS: sources served many times in a row last */
+};
+
+struct Scheduling {
+    SchedulerType type;
+    uint32_t marking_cap; /**< PAR-BS: oldest per source and bank in a batch. */
+    uint32_t quantum; /**< ATLAS: cycles between rankings. */
+    uint32_t blacklist_streak; /**< BLISS: requests in a row that blacklist a source. */
+    uint32_t blacklist_interval; /**< BLISS: cycles between clearing the blacklist. */
 };
 
 struct Config {    
@@ -86,6 +212,7 @@ struct Config {
     Timing timing;
     Energy energy;
     Policy policy;
+    Scheduling scheduling;
     
     uint32_t nDevice;
     uint32_t nChannel;
@@ -93,14 +220,67 @@ struct Config {
     uint32_t nBank;
     uint32_t nRow;
     uint32_t nColumn;
+    uint32_t nSource; /**< Sources told apart by the scheduler, others fold onto them. */
     
     uint32_t nRequest;
     uint32_t nTransaction;
+    uint32_t nWrite; /**< Write buffer apart from the transactions; 0 to share them. */
     uint32_t nCommand;
     
     Config(std::map<std::string, int> config);
 };
 
+/** Geometry, timing and policy of a controller, as configured at run time. */
+class RuntimeSpec
+{
+protected:
+    uint32_t m_nRank;
+    uint32_t m_nBank;
+    Timing m_timing;
+    Policy m_policy;
+
+public:
+    RuntimeSpec(Config *config) :
+        m_nRank(config->nRank),
+        m_nBank(config->nBank),
+        m_timing(config->timing),
+        m_policy(config->policy) {}
+    
+    uint32_t nRank() const { return m_nRank; }
+    uint32_t nBank() const { return m_nBank; }
+    const Timing &timing() const { return m_timing; }
+    const Policy &policy() const { return m_policy; }
+};
+
+/** DDR3-1600 x8 preset with one rank of 8 banks, as set up by default.
+ *  Known at compile time, so timing checks fold into constants and loops
+ *  over banks unroll. */
+class DDR3_1600
+{
+protected:
+    static constexpr TimingParameters parameters = {
+        0, 0, 1, 1,
+        5, 4, 0, 4,
+        15, 5, 4, 5,
+        4, 4, 4, 6, 1,
+        64, 3120, 16, 3, 3,
+        28, 4, 72,
+    };
+    static constexpr Timing m_timing = deriveTiming(parameters);
+    static constexpr Policy m_policy = {0, 5, PAGE_open, 0, 0, 0, 0, false, false, 0, 0};
+
+public:
+    DDR3_1600(Config *config) {}
+    
+    static constexpr uint32_t nRank() { return 1; }
+    static constexpr uint32_t nBank() { return 8; }
+    static constexpr const Timing &timing() { return m_timing; }
+    static constexpr const Policy &policy() { return m_policy; }
+    
+    /** True if config has this geometry, timing and policy. */
+    static bool matches(Config *config);
+};
+
 
 
 struct Coordinates {
@@ -131,18 +311,24 @@ enum CommandType {
     COMMAND_read_precharge, /**< column read with auto row precharge */
     COMMAND_write_precharge, /**< column write with auto row precharge */
     COMMAND_refresh, /**< rank refresh */
+    COMMAND_refresh_bank, /**< bank refresh */
     COMMAND_powerup, /**< rank powerup */
     COMMAND_powerdown, /**< rank powerdown */
+    COMMAND_selfrefresh_entry, /**< rank self-refresh entry */
+    COMMAND_selfrefresh_exit, /**< rank self-refresh exit */
 };
 
 struct Request {
+    uint64_t id;
     uint64_t address;
     bool is_write;
+    uint16_t source;
+    Coordinates coordinates; /**< Decoded from address on arrival. */
     
     int64_t allocateTime;
     int64_t releaseTime;
     
-    inline int latency() { return releaseTime - allocateTime; };
+    inline int64_t latency() { return releaseTime - allocateTime; };
     
     friend std::ostream &operator <<(std::ostream &os, Request &request) {
         os << "{"
@@ -155,6 +341,7 @@ struct Request {
 
 struct Transaction : public Coordinates {
     Request *request;
+    bool is_marked; /**< Marked by the scheduler, as in a batch. */
     
     friend std::ostream &operator <<(std::ostream &os, Transaction &transaction) {
         os << "{"
@@ -185,57 +372,135 @@ struct Command : public Coordinates {
 
 
 
-struct BankData {
-    int32_t demandCount;
-    int32_t supplyCount;
-    int32_t rowBuffer;
-    uint8_t hitCount;
+/** References to a bank's entries in the state arrays of its channel, a
+ *  proxy rather than a copy: every write goes through to the arrays. */
+struct BankRef {
+    int32_t &demandCount;
+    int32_t &supplyCount;
+    int32_t &rowBuffer;
+    uint8_t &hitCount;
+    uint8_t &pageCounter; /**< Saturating, 2 and up to keep the row open. */
+    int32_t &pageRow; /**< Row of the last page prediction, -1 once trained. */
 };
 
 struct RankData {
     int32_t demandCount;
     int32_t activeCount;
-    int32_t refreshTime;
-    bool is_sleeping;
+    int64_t refreshTime; /**< When the next refresh falls due. */
+    int32_t refreshDebt; /**< Refreshes due and not done, negative if done ahead. */
+    uint8_t refreshBank; /**< Next bank to refresh, per bank. */
+    uint64_t refreshMask; /**< Banks kept from new work for a refresh. */
+    int64_t idleTime; /**< Since when it has had nothing to do, -1 if busy. */
+    bool is_sleeping; /**< Powered down or in self-refresh. */
+    bool is_selfrefreshing;
 };
 
-
-
-class Bank
-{
-protected:
-    Config *config;
+/** Counters accumulated over a simulation run. */
+struct Statistics {
+    uint64_t readCount;
+    uint64_t writeCount;
+    uint64_t readLatency; /**< Sum of read request latencies. */
+    uint64_t writeLatency; /**< Sum of write request latencies. */
     
-    BankData data;
+    uint64_t commandCount[COMMAND_selfrefresh_exit+1];
+    uint64_t turnaroundCount; /**< Switches between reads and writes. */
+    uint64_t rowHitCount; /**< Column accesses to a row already open. */
+    uint64_t rowMissCount; /**< Column accesses right after an activation. */
+    uint64_t pagePredictionCount;
+    uint64_t pageMispredictionCount;
+    uint64_t powerdownCycles; /**< Rank cycles powered down. */
+    uint64_t selfrefreshCycles; /**< Rank cycles in self-refresh. */
     
-    int64_t actReadyTime;
-    int64_t preReadyTime;
-    int64_t readReadyTime;
-    int64_t writeReadyTime;
+    uint64_t clockEnergy;
+    uint64_t commandBusEnergy;
+    uint64_t addressBusEnergy;
+    uint64_t dataBusEnergy;
     
-public:
-    Bank(Config *_config);    
-    virtual ~Bank();
+    uint64_t actEnergy;
+    uint64_t preEnergy;
+    uint64_t readEnergy;
+    uint64_t writeEnergy;
+    uint64_t refreshEnergy;
+    uint64_t backgroundEnergy;
     
-    inline BankData &getBankData(Coordinates &coordinates);
-    inline int64_t getReadyTime(CommandType type, Coordinates &coordinates);
-    inline int64_t getFinishTime(int64_t clock, CommandType type, Coordinates &coordinates);
+    friend std::ostream &operator <<(std::ostream &os, Statistics &stats) {
+        static const char *mne[] = {
+            "act", "pre", "read", "write", "read_pre", "write_pre", 
+            "refresh", "refresh_bank", "powerup", "powerdown",
+            "selfrefresh_entry", "selfrefresh_exit",
+        };
+        
+        os << "read_count: " << stats.readCount << "\n"
+           << "write_count: " << stats.writeCount << "\n"
+           << "read_latency: " << (stats.readCount ? (double)stats.readLatency/stats.readCount : 0) << "\n"
+           << "write_latency: " << (stats.writeCount ? (double)stats.writeLatency/stats.writeCount : 0) << "\n";
+        for (int type=0; type<=COMMAND_selfrefresh_exit; ++type) {
+            os << "command_" << mne[type] << ": " << stats.commandCount[type] << "\n";
+        }
+        os << "turnarounds: " << stats.turnaroundCount << "\n";
+        os << "row_hits: " << stats.rowHitCount << "\n"
+           << "row_misses: " << stats.rowMissCount << "\n"
+           << "page_predictions: " << stats.pagePredictionCount << "\n"
+           << "page_mispredictions: " << stats.pageMispredictionCount << "\n";
+        os << "powerdown_cycles: " << stats.powerdownCycles << "\n"
+           << "selfrefresh_cycles: " << stats.selfrefreshCycles << "\n";
+        os << "energy_act: " << stats.actEnergy << "\n"
+           << "energy_read: " << stats.readEnergy << "\n"
+           << "energy_write: " << stats.writeEnergy << "\n"
+           << "energy_refresh: " << stats.refreshEnergy << "\n"
+           << "energy_background: " << stats.backgroundEnergy << "\n";
+        return os;
+    }
 };
 
-class Rank
+
+
+/** State of a channel and of all its ranks and banks. Per-bank state
+ *  lives in flat arrays indexed by rank*nBank+bank, and per-rank state in
+ *  arrays indexed by rank, all in one block so that every bank of the
+ *  channel sits in a few cache lines and scans over them vectorize. */
+template<class Spec>
+class Channel
 {
 protected:
     Config *config;
+    Spec spec;
+    
+    void *memory; /**< Block holding the arrays below. */
+    size_t length; /**< Bytes of memory. */
+    
+    // Banks, indexed by rank*nBank+bank
+    int32_t *bankDemandCount;
+    int32_t *bankSupplyCount;
+    int32_t *bankRowBuffer; /**< -1 if the bank is precharged. */
+    uint8_t *bankHitCount;
+    uint8_t *bankPageCounter;
+    int32_t *bankPageRow;
+    int64_t *bankActReadyTime;
+    int64_t *bankPreReadyTime;
+    int64_t *bankReadReadyTime;
+    int64_t *bankWriteReadyTime;
+    
+    // Ranks, indexed by rank
+    RankData *rankData;
+    int64_t *rankActReadyTime;
+    int64_t *rankFawReadyTime; /**< Four per rank, the oldest first. */
+    int64_t *rankReadReadyTime;
+    int64_t *rankWriteReadyTime;
+    int64_t *rankPowerupReadyTime;
     
-    Bank** banks;
+    int8_t rankSelect;
     
-    RankData data;
+    int64_t lastClock; /**< The last cycled clock, for energy of skipped cycles. */
     
-    int64_t actReadyTime;
-    int64_t fawReadyTime[4];
+    int64_t anyReadyTime;
     int64_t readReadyTime;
     int64_t writeReadyTime;
-    int64_t powerupReadyTime;
+    
+    uint64_t clockEnergy;
+    uint64_t commandBusEnergy;
+    uint64_t addressBusEnergy;
+    uint64_t dataBusEnergy;
     
     uint64_t actEnergy;
     uint64_t preEnergy;
@@ -244,73 +509,330 @@ protected:
     uint64_t refreshEnergy;
     uint64_t backgroundEnergy;
     
+    uint64_t powerdownCycles;
+    uint64_t selfrefreshCycles;
+    
+    inline int getBankIndex(Coordinates &coordinates) {
+        return coordinates.rank*spec.nBank() + coordinates.bank;
+    }
+    
+    inline int64_t getRankReadyTime(CommandType type, Coordinates &coordinates);
+    inline int64_t getRankFinishTime(int64_t clock, CommandType type, Coordinates &coordinates);
+    inline int64_t getBankReadyTime(CommandType type, int index);
+    inline int64_t getBankFinishTime(int64_t clock, CommandType type, int index);
+
+    inline void warmRefresh(int64_t clock, uint8_t rank);
+
 public:
-    Rank(Config *_config);
-    virtual ~Rank();
+    Channel(Config *_config);
+    virtual ~Channel();
     
-    inline BankData &getBankData(Coordinates &coordinates);
+    inline BankRef getBankRef(Coordinates &coordinates);
     inline RankData &getRankData(Coordinates &coordinates);
     inline int64_t getReadyTime(CommandType type, Coordinates &coordinates);
     inline int64_t getFinishTime(int64_t clock, CommandType type, Coordinates &coordinates);
     
+    // Banks of a rank as bitmasks, bit i for bank i
+    
+    /** Banks with an open row. */
+    inline uint64_t getOpenBanks(Coordinates &coordinates);
+    /** Banks with an open row and no pending transaction. */
+    inline uint64_t getIdleBanks(Coordinates &coordinates);
+    /** Banks with a pending transaction. */
+    inline uint64_t getBusyBanks(Coordinates &coordinates);
+    
+    /** True if an access to bank precharges its row after it, as the page
+     *  policy has it; is_last if no other hit on the row is pending. */
+    inline bool is_closing(BankRef &bank, bool is_last);
+    /** Train the page predictor of bank on an access to row, if it has a
+     *  prediction to check; true if that prediction was wrong. */
+    inline bool trainPage(BankRef &bank, int32_t row);
+    
+    /** Cycles between refreshes of a rank, by the refresh mode. */
+    inline int64_t getRefreshInterval() {
+        const Policy &policy = spec.policy();
+        return spec.timing().rank.refresh_interval/(policy.refresh_per_bank ? spec.nBank() : 1);
+    }
+    
+    /** Earliest ready time later than clock, or INT64_MAX if there is none. */
+    inline int64_t getNextEventTime(int64_t clock);
+    
+    // Functional warm-up, for sampling: the state as of clock, without timing
+    
+    /** Refresh every rank due by clock. */
+    inline void warm(int64_t clock);
+    /** Refresh the rank of coordinates if due by clock, and open its row
+     *  as the page policy would have left it. */
+    inline void warm(int64_t clock, Coordinates &coordinates);
+    
     inline void cycle(int64_t clock);
+    inline void getStatistics(Statistics &stats);
+    
+    void checkpoint(Checkpoint &checkpoint);
 };
 
-class Channel
+/** Order in which the schedule policy tries transactions, as tiers of
+ *  slots: the ready ones tier by tier, and oldest first within each.
+ *  Tiers come in groups, and row misses wait only for row hits of their
+ *  own group or an earlier one, so that a group goes before the row hits
+ *  of later ones. */
+class Priorities
 {
 protected:
-    Config *config;
+    size_t words;
+    std::vector<uint64_t> masks; /**< Slots of each tier. */
+    std::vector<int> groups; /**< Group of each tier. */
+    std::vector<uint64_t> scopes; /**< Slots of each group and those before. */
+
+public:
+    Priorities(size_t _words) : words(_words) {}
     
-    Rank** ranks;
+    int size() { return groups.size(); }
+    int getGroup(int tier) { return groups[tier]; }
+    const uint64_t *getTier(int tier) { return &masks[tier*words]; }
+    const uint64_t *getScope(int group) { return &scopes[group*words]; }
+    /** True if the scope of group is every tier. */
+    bool is_last(int group) { return (group+1)*words == scopes.size(); }
     
-    int8_t rankSelect;
+    void clear() {
+        masks.clear();
+        groups.clear();
+        scopes.clear();
+    }
     
-    int64_t anyReadyTime;
-    int64_t readReadyTime;
-    int64_t writeReadyTime;
+    /** Add a tier of the slots of mask after the others, in the last group
+     *  or in a new one after it. */
+    void add(const uint64_t *mask, bool is_new_group) {
+        if (groups.empty() || is_new_group) {
+            size_t scope = scopes.size();
+            scopes.resize(scope + words, 0);
+            if (scope) std::copy(&scopes[scope - words], &scopes[scope], &scopes[scope]);
+        }
+        
+        groups.push_back(scopes.size()/words - 1);
+        masks.insert(masks.end(), mask, mask + words);
+        
+        uint64_t *scope = &scopes[scopes.size() - words];
+        for (size_t i=0; i<words; ++i) scope[i] |= mask[i];
+    }
+};
+
+/** The pending transactions of a channel as a Scheduler sees them, by
+ *  masks over their slots, which are in arrival order. */
+struct PendingTransactions {
+    size_t words;
+    uint32_t nSource;
+    uint32_t nBank; /**< Of all ranks. */
+    const uint64_t *occupied;
+    const uint64_t *sourceMasks; /**< Of each source in turn. */
+    const uint64_t *bankMasks; /**< Of each bank in turn. */
+    const uint64_t *markMask; /**< Marked by the scheduler, until served. */
+};
+
+/** Policy ordering the transactions of a channel among their sources. */
+class Scheduler
+{
+public:
+    virtual ~Scheduler() {}
     
-    uint64_t clockEnergy;
-    uint64_t commandBusEnergy;
-    uint64_t addressBusEnergy;
-    uint64_t dataBusEnergy;
+    /** The scheduler of config->scheduling. */
+    static Scheduler *create(Config *config);
     
+    /** Set priorities over every pending transaction before scheduling on
+     *  clock, and set the slots of any to mark in marks, which is clear. */
+    virtual void prioritize(int64_t clock, const PendingTransactions &pending,
+        Priorities &priorities, uint64_t *marks) = 0;
+    /** A read or write of source issued on clock. */
+    virtual void serve(int64_t clock, uint32_t source) {}
+    
+    /** Save or restore the state. */
+    virtual void checkpoint(Checkpoint &checkpoint) {}
+};
+
+/** The controller of a channel, as driven by a hub, whatever its Spec. */
+class Controller
+{
 public:
-    Channel(Config *_config);
-    virtual ~Channel();
+    virtual ~Controller() {}
     
-    inline BankData &getBankData(Coordinates &coordinates);
-    inline RankData &getRankData(Coordinates &coordinates);
-    inline int64_t getReadyTime(CommandType type, Coordinates &coordinates);
-    inline int64_t getFinishTime(int64_t clock, CommandType type, Coordinates &coordinates);
+    virtual bool addRequest(int64_t clock, uint64_t address, bool is_write, uint64_t id = 0,
+        uint16_t source = 0) = 0;
+    /** Add requests[order[i]], already decoded into coordinates, for i up
+     *  to count and in that order; the number added before one is rejected. */
+    virtual size_t addRequests(int64_t clock, const Submission *requests,
+        const Coordinates *coordinates, const uint32_t *order, size_t count) = 0;
+    /** How many more requests would be added right now. */
+    virtual size_t getRoom() = 0;
+    virtual void cycle(int64_t clock) = 0;
     
-    inline void cycle(int64_t clock);
+    /** Stage a request for run(), only if it is sure to be accepted. */
+    virtual bool stageRequest(int64_t clock, uint64_t address, bool is_write, uint64_t id = 0,
+        uint16_t source = 0) = 0;
+    /** Cycle from clock from to clock to, adding staged requests on their clocks. */
+    virtual void run(int64_t from, int64_t to, bool event_driven) = 0;
+    
+    /** Earliest clock after clock at which cycle() may change any state. */
+    virtual int64_t getNextEventTime(int64_t clock) = 0;
+    virtual void getStatistics(Statistics &stats) = 0;
+    
+    /** True if no request is in flight. */
+    virtual bool is_idle() = 0;
+    /** Functional warm-up of an idle controller, see MemoryControllerHub. */
+    virtual void warm(int64_t clock, uint64_t address) = 0;
+    virtual void warm(int64_t clock) = 0;
+    
+    /** Report every retired request to listener, if not NULL. */
+    virtual void setListener(Listener *listener) = 0;
+    
+    /** Also queue every retired request on a ring of size slots, size a
+     *  power of 2, for another thread to poll; if early, as soon as its
+     *  release time is fixed instead. */
+    virtual void enableCompletions(size_t size, bool early = false) = 0;
+    /** Take up to count completed requests, oldest first; how many were taken. */
+    virtual size_t pollCompletions(Completion *completions, size_t count) = 0;
+    
+    /** Save or restore all state but the listener and completions. */
+    virtual void checkpoint(Checkpoint &checkpoint) = 0;
+    
+    /** Controller specialized for config if it matches a preset and
+     *  specialize is set, configured at run time otherwise. */
+    static Controller *create(Config *config, bool specialize = true);
 };
 
-class MemoryController
+template<class Spec>
+class MemoryController final : public Controller
 {
 protected:
     Config *config;
+    Spec spec;
     
-    Channel channel;
+    Channel<Spec> channel;
     
     Queue<Request *>
         requestQueue;
-    LinkedList<Request>
+    Pool<Request>
         dataBuffer;
-    LinkedList<Transaction>
+    TimingWheel<Request *>
+        releaseWheel; /**< Requests with a release time, until they retire. */
+    SlotPool<Transaction>
         transactionQueue;
+    
+    // Bitmasks over transaction slots, which are in arrival order
+    uint64_t *bankMasks; /**< Pending transactions of each bank. */
+    uint64_t *writeMask; /**< Pending writes. */
+    uint32_t pendingReads;
+    uint32_t pendingWrites;
+    bool is_draining; /**< Only writes go, by the write drain policy. */
+    uint64_t *sourceMasks; /**< Pending transactions of each source. */
+    uint64_t *markMask; /**< Pending transactions marked by the scheduler. */
+    int lastDirection; /**< 1 after a write, 0 after a read, -1 before either. */
+    uint64_t *candidateMask; /**< Scratch for nextTransaction(). */
+    std::unordered_map<uint64_t, std::vector<uint64_t> >
+        rowMasks; /**< Pending transactions by bank and row. */
     Queue<Command>
         commandQueue;
+    Queue<Request>
+        arrivals; /**< Requests staged for run(). */
+    
+    Scheduler *scheduler;
+    Priorities priorities; /**< Set by the scheduler each cycle. */
     
+    Statistics stats;
+    
+    Listener *listener;
+    
+    void *completionMemory;
+    Ring<Completion> *completions; /**< NULL unless enabled. */
+    bool earlyCompletions;
+    std::deque<Completion>
+        overflow; /**< Completions that found the ring full, after it in order. */
+    std::mutex overflowLock;
+    std::atomic<size_t> overflowCount;
+    
+    void pushRequest(int64_t clock, uint64_t address, bool is_write, uint64_t id, uint16_t source,
+        const Coordinates &coordinates);
+    void queueCompletion(const Completion &completion);
     bool addCommand(int64_t clock, CommandType type, Coordinates &coordinates, Request *request);
+    bool is_full(Request &request);
     bool addTransaction(int64_t clock, Request &request);
+    void removeTransaction(Transaction &transaction);
+    void indexTransaction(Transaction &transaction);
+    void compactTransactions();
+    uint64_t *getBankMask(Coordinates &coordinates);
+    uint64_t *getSourceMask(Transaction &transaction);
+    uint64_t *getRowMask(Coordinates &coordinates, uint32_t row);
+    bool is_ready(int64_t clock, CommandType type, Coordinates &coordinates);
+    uint64_t getRefreshMask(Coordinates &coordinates);
+    inline CommandType getWakeCommand(RankData &rank);
+    inline bool is_supplied(Coordinates &coordinates, BankRef &bank, int group);
+    void prioritize(int64_t clock);
+    void findCandidates(int64_t clock, int group, uint64_t readable, uint64_t writable);
+    Transaction *nextTransaction(int64_t clock, int &cursor);
 
 public:
     MemoryController(Config *_config);
     virtual ~MemoryController();
     
-    bool addRequest(int64_t clock, uint64_t address, bool is_write);
+    bool addRequest(int64_t clock, uint64_t address, bool is_write, uint64_t id = 0,
+        uint16_t source = 0);
+    size_t addRequests(int64_t clock, const Submission *requests,
+        const Coordinates *coordinates, const uint32_t *order, size_t count);
+    size_t getRoom();
     void cycle(int64_t clock);
+    
+    bool stageRequest(int64_t clock, uint64_t address, bool is_write, uint64_t id = 0,
+        uint16_t source = 0);
+    void run(int64_t from, int64_t to, bool event_driven);
+    
+    int64_t getNextEventTime(int64_t clock);
+    void getStatistics(Statistics &stats);
+    
+    bool is_idle();
+    void warm(int64_t clock, uint64_t address);
+    void warm(int64_t clock);
+    
+    void setListener(Listener *listener);
+    
+    void enableCompletions(size_t size, bool early = false);
+    size_t pollCompletions(Completion *completions, size_t count);
+    
+    void checkpoint(Checkpoint &checkpoint);
+};
+
+/** Requests in time order for MemoryControllerHub::drive(), from a trace,
+ *  a ring or any other source that fetch() reads. */
+class RequestSource
+{
+protected:
+    std::vector<Submission> requests; /**< Fetched and not added yet. */
+    std::vector<int64_t> times;
+    size_t due; /**< How many of them were due by the last peek(). */
+    
+    /** Take the next request and its time; false if there is none yet, with
+     *  horizon set to the time no later one comes before, INT64_MAX once
+     *  none ever will. */
+    virtual bool fetch(Submission &request, int64_t &time, int64_t &horizon) = 0;
+    /** Fetch one more request behind the pending ones, as fetch(). */
+    bool fetchMore(int64_t &horizon);
+
+public:
+    RequestSource() : due(0) {}
+    virtual ~RequestSource() {}
+    
+    /** The oldest request not added yet, with its time; NULL if there is
+     *  none yet, with time set to the horizon. */
+    const Submission *front(int64_t &time);
+    /** Up to count of the oldest requests, as long as they are due by clock,
+     *  in requests; how many. If none, time is set to that of the next one,
+     *  or to the horizon. */
+    size_t peek(int64_t clock, size_t count, const Submission *&requests, int64_t &time);
+    /** Drop the count oldest requests, once added. */
+    void pop(size_t count = 1);
+    /** How many requests were fetched and not added. */
+    size_t pending() { return requests.size(); }
+    
+    /** Every cycle before clock has been simulated. */
+    virtual void reach(int64_t clock) {}
 };
 
 class MemoryControllerHub : public Memory::Memory
@@ -318,14 +840,261 @@ class MemoryControllerHub : public Memory::Memory
 protected:
     Config *config;
     
-    MemoryController** controllers;
+    Controller** controllers;
+
+    // Scratch of addRequests()
+    std::vector<Coordinates> decoded;
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> starts;
+    std::vector<size_t> rooms;
 
 public:
-    MemoryControllerHub(Config *_config);
+    MemoryControllerHub(Config *_config, bool specialize = true);
     virtual ~MemoryControllerHub();
     
-    bool addRequest(int64_t clock, uint64_t address, bool is_write);
+    bool addRequest(int64_t clock, uint64_t address, bool is_write, uint64_t id = 0,
+        uint16_t source = 0);
+    /** Add a batch of requests on clock, decoded in one pass and handed to
+     *  each channel in a single call. Within a channel they are taken in
+     *  order, up to the first one rejected; if in_order, none is taken
+     *  after the first one rejected in any channel, as addRequest() one by
+     *  one would. accepted[c], if not NULL, gets how many of channel c were
+     *  taken. Returns how many were taken in all. */
+    size_t addRequests(int64_t clock, const Submission *requests, size_t count, uint32_t *accepted = NULL,
+        bool in_order = false);
     void cycle(int64_t clock);
+    /** Cycle from clock up to until, adding the requests of source on their
+     *  time, those due together as a batch, and retrying a rejected one
+     *  every cycle. Once source has run
+     *  out, stop, or if drain, go on until every request has retired.
+     *  Return the clock reached. */
+    int64_t drive(RequestSource &source, int64_t clock, int64_t until, bool event_driven, bool drain);
+    
+    /** Earliest clock after clock at which cycle() may change any state.
+     *  Cycles in between can be skipped without altering the results. */
+    int64_t getNextEventTime(int64_t clock);
+    void getStatistics(Statistics &stats);
+    /** Fewest cycles from scheduling a request to its release: one not
+     *  scheduled before clock is released at clock + lookahead or later. */
+    int64_t getLookahead();
+    
+    /** True if no request is in flight in any channel. */
+    bool is_idle();
+    /** Functional warm-up, for sampling, while is_idle(): leave the row of
+     *  address open as the page policy would, and refresh its rank if due
+     *  by clock, all without simulating any timing. Requests come in time
+     *  order, though clock may be behind the last cycle. */
+    void warm(int64_t clock, uint64_t address);
+    /** Refresh every rank due by clock, before cycling on from clock. */
+    void warm(int64_t clock);
+    
+    /** Report every retired request to listener, if not NULL. */
+    void setListener(Listener *listener);
+    
+    /** Queue the requests each channel retires on a lock-free ring of size
+     *  slots, size a power of 2, so that a single consumer thread can drain
+     *  them while the channels run. Completions that find their ring full
+     *  wait in the controller until the consumer gets to them. If early,
+     *  a request is queued as soon as its release time is fixed, at least
+     *  getLookahead() cycles ahead of it. */
+    void enableCompletions(size_t size, bool early = false);
+    /** Take up to count completed requests, channel by channel and oldest
+     *  first within each; how many were taken. */
+    size_t pollCompletions(Completion *completions, size_t count);
+    
+    /** Save the state of every channel to checkpoint, or restore it, as
+     *  checkpoint is saving or not; false if that failed, or if the
+     *  checkpoint was taken with different channels or queue sizes.
+     *  Listener and completions are not part of it. */
+    bool checkpoint(Checkpoint &checkpoint);
+};
+
+/** Hub stepping its controllers on a thread pool, in epochs of cycles.
+ *  Channels share no state, so as long as every request of an epoch is
+ *  staged beforehand the results are identical to the serial hub. */
+class ParallelMemoryControllerHub : public MemoryControllerHub
+{
+protected:
+    ThreadPool pool;
+
+public:
+    ParallelMemoryControllerHub(Config *_config, int nThread, bool specialize = true);
+    virtual ~ParallelMemoryControllerHub();
+    
+    /** Stage a request for the next epoch; false if its channel may reject it. */
+    bool stageRequest(int64_t clock, uint64_t address, bool is_write, uint64_t id = 0,
+        uint16_t source = 0);
+    /** Run all channels from clock from to clock to, staged requests included. */
+    void run(int64_t from, int64_t to, bool event_driven);
 };
 
-};
\ No newline at end of file
+/** Hub simulated on a thread of its own, for embedding in a host simulator.
+ *  The host adds requests in time order and may promise a horizon, a time
+ *  no later request comes before; the thread simulates up to it, retrying
+ *  rejected requests on every cycle. Completions are queued as soon as
+ *  their release time is fixed, getLookahead() cycles or more ahead of it,
+ *  so the simulation can trail the host by that much before the host has
+ *  to wait for a result. The host side must be a single thread. */
+class AsyncMemoryControllerHub : public Memory::Memory
+{
+protected:
+    /** The requests of the ring, as the promises of the host allow. */
+    class HostSource : public RequestSource {
+    protected:
+        AsyncMemoryControllerHub *hub;
+        
+        bool fetch(Submission &request, int64_t &time, int64_t &horizon);
+    
+    public:
+        HostSource(AsyncMemoryControllerHub *_hub) : hub(_hub) {}
+        
+        void reach(int64_t clock);
+    };
+    
+    MemoryControllerHub *hub;
+    bool event_driven;
+    bool drain;
+    int64_t max_clock;
+    int64_t lookahead;
+    
+    void *requestMemory;
+    Ring<Request> *requests;
+    
+    std::atomic<int64_t> horizon;
+    std::atomic<uint32_t> closed;
+    std::atomic<int64_t> progress; /**< Clock up to which all is simulated. */
+    int64_t finalClock;
+    
+    std::thread thread;
+    
+    void simulate();
+
+public:
+    /** Run hub on a new thread, with a ring of size requests from the host,
+     *  size a power of 2, and size completions per channel back to it. Once
+     *  closed, the thread stops after the last request is added, or if
+     *  drain, after it has retired. */
+    AsyncMemoryControllerHub(MemoryControllerHub *_hub, size_t size, bool _event_driven,
+        int64_t _max_clock = INT64_MAX, bool _drain = true);
+    virtual ~AsyncMemoryControllerHub();
+    
+    /** Queue a request, false if the ring is full; also promises a horizon
+     *  of clock. */
+    bool addRequest(int64_t clock, uint64_t address, bool is_write, uint64_t id = 0,
+        uint16_t source = 0);
+    /** Promise that no request comes before horizon. */
+    void setHorizon(int64_t horizon);
+    /** Promise that no request comes at all; the thread ends once every
+     *  request has been added or retired, as drain is, or at max_clock. */
+    void close();
+    
+    /** Take up to count completions, as soon as their release time is fixed;
+     *  a host acts on them at their release time. */
+    size_t pollCompletions(Completion *completions, size_t count);
+    /** Wait until every request released by clock has been queued, which
+     *  needs a horizon past clock - getLookahead(). */
+    void sync(int64_t clock);
+    int64_t getLookahead() { return lookahead; }
+    
+    /** True once the thread has ended. */
+    bool is_finished();
+    /** Wait for the thread to end, return the final clock. Statistics of
+     *  hub are complete afterwards. */
+    int64_t finish();
+};
+
+/** Analytical memory for design space exploration: the latency of each
+ *  request is worked out on arrival from the state of its row buffer, as
+ *  a hit, a miss or a conflict, from when its bank is free and its rank
+ *  and channel have room for its commands, and from the refreshes due in
+ *  between. Banks serve their requests in arrival order; a request waits
+ *  to be admitted while as many as the hub buffers are in flight in its
+ *  channel. It runs nothing per cycle, and takes every request.
+ *  As nothing is reordered, traffic on few banks saturates them where the
+ *  hub would serve row hits first: latencies then come out far too high. */
+class LatencyModel : public Memory::Memory
+{
+protected:
+    struct Bank {
+        int32_t row; /**< Open row, -1 if precharged. */
+        uint8_t hits; /**< Accesses since the row was opened. */
+        int64_t readyTime; /**< Earliest next command. */
+        int64_t preReadyTime; /**< Earliest precharge. */
+        int64_t accessTime; /**< Last column access. */
+        uint8_t pageCounter; /**< As the controller's page predictor. */
+        int32_t lastRow; /**< Of the last access, -1 before any. */
+    };
+    
+    /** The latest commands of a kind on a rank or a channel, in time
+     *  order, for those of later requests to fit in between. */
+    struct Slots {
+        static const int size = 8;
+        int64_t time[size];
+        bool is_write[size];
+        int count;
+    };
+    
+    /** Cycles between two commands of a kind, by whether each is a write. */
+    typedef uint32_t Spacing[2][2];
+    
+    struct Rank {
+        int64_t refreshTime; /**< Next refresh deadline. */
+        uint8_t refreshBank; /**< Next bank to refresh, per bank. */
+        int64_t idleTime; /**< Every row is closed after it, and it powers down. */
+        int64_t wakeTime; /**< Rows open from then on, once it wakes. */
+        Slots activates;
+        Slots accesses;
+    };
+    
+    struct Bus {
+        Slots accesses;
+        uint32_t count; /**< Requests in flight, in releases. */
+    };
+    
+    Config *config;
+    
+    Spacing actSpacing;
+    Spacing rankSpacing;
+    Spacing busSpacing;
+    
+    std::vector<Bank> banks; /**< Indexed by (channel*nRank+rank)*nBank+bank. */
+    std::vector<Rank> ranks; /**< Indexed by channel*nRank+rank. */
+    std::vector<Bus> buses; /**< Indexed by channel. */
+    std::vector<int64_t> releases; /**< Of the requests in flight in each channel, a min-heap. */
+    int64_t admitTime; /**< Requests are admitted in order. */
+    
+    Statistics stats;
+    uint64_t hitCount;
+    uint64_t missCount;
+    uint64_t conflictCount;
+    int64_t lastClock; /**< Latest release so far. */
+    
+    Listener *listener;
+    
+    int64_t admit(int64_t clock, Bus &bus, int64_t *releases);
+    void refresh(int64_t clock, Rank &rank, Bank *banks);
+    static int64_t fit(int64_t clock, bool is_write, Slots &slots, const Spacing &spacing);
+
+public:
+    LatencyModel(Config *_config);
+    virtual ~LatencyModel();
+    
+    /** Work out the latency of a request, which is always taken. Requests
+     *  come in time order. */
+    bool addRequest(int64_t clock, uint64_t address, bool is_write, uint64_t id = 0,
+        uint16_t source = 0);
+    
+    /** Report every request to listener, if not NULL, as it is added. */
+    void setListener(Listener *listener);
+    
+    /** Counts, latencies, commands and their energy; background energy
+     *  is not modelled. */
+    void getStatistics(Statistics &stats);
+    /** Requests that hit an open row, found their bank precharged, or had
+     *  to close another row. */
+    void getRowStatistics(uint64_t &hits, uint64_t &misses, uint64_t &conflicts);
+    /** Latest release time so far. */
+    int64_t getClock() { return lastClock; }
+};
+
+};
@@ -1,42 +1,815 @@
 #include "dram.h"
+#include "shm.h"
+#include "trace.h"
+#include <cinttypes>
 #include <cstdlib>
 #include <fstream>
 #include <cstdio>
 #include <cstring>
+#include <ctime>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <sched.h>
+#include <unistd.h>
 
 using namespace DRAM;
 
 void getSettings(std::map<std::string, int> &settings);
 
+struct Options {
+    bool event_driven;
+    bool runtime;
+    bool shared;
+    bool async;
+    int threads;
+    int64_t epoch;
+    int64_t max_clock;
+    const char *save;
+    const char *restore;
+    bool model;
+    bool calibrate;
+    // Sampling, if period is set: each period of cycles ends with warmup
+    // detailed cycles and then a window of measured ones
+    int64_t period;
+    int64_t window;
+    int64_t warmup;
+    const char *grid;
+    bool json;
+    bool fairness;
+};
+
+/** Where a replay stands, as kept in a checkpoint next to the hub. */
+struct Position {
+    int64_t clock;
+    uint64_t id; /**< Id of the next request. */
+    uint64_t offset; /**< Trace offset of the next record. */
+};
+
+/** The records of a trace, numbered on from a first id. */
+class TraceSource : public RequestSource
+{
+protected:
+    bool fetch(Submission &request, int64_t &time, int64_t &horizon) {
+        const Trace::Record *record = trace->next();
+        if (!record) {
+            horizon = INT64_MAX;
+            return false;
+        }
+        
+        request.id = id++;
+        request.address = record->address;
+        request.is_write = record->is_write();
+        request.source = record->source;
+        time = record->time;
+        
+        return true;
+    }
+
+public:
+    Trace::Reader *trace;
+    uint64_t id; /**< Id of the next record read. */
+    
+    TraceSource(Trace::Reader *_trace, uint64_t _id = 0) : trace(_trace), id(_id) {}
+};
+
+/** Run the requests of a trace file from position, and leave position
+ *  at the end of the run; return the final clock. */
+static int64_t replay(MemoryControllerHub *mch, ParallelMemoryControllerHub *pmch,
+    Trace::Reader *trace, const Options &options, Position &position)
+{
+    TraceSource source(trace, position.id);
+    int64_t clock = position.clock, time;
+    if (!pmch) {
+        clock = mch->drive(source, clock, options.max_clock, options.event_driven, false);
+    }
+    while (pmch && source.front(time) && clock < options.max_clock) {
+        // Stage an epoch of requests, up to one that might be rejected
+        int64_t end = std::min(clock + options.epoch, options.max_clock), at = clock;
+        for (const Submission *request; (request = source.front(time)); source.pop()) {
+            at = std::max(at, time);
+            if (at >= end) break;
+            if (!pmch->stageRequest(at, request->address, request->is_write, request->id, request->source)) {
+                end = at;
+                break;
+            }
+        }
+        // stop right after the last request, as the serial loop does
+        if (!source.front(time)) end = at;
+        
+        // this also adds the requests staged for end itself, before
+        // a rejected one is retried below
+        pmch->run(clock, end, options.event_driven);
+        if (end > clock || !source.front(time)) {
+            clock = end;
+        } else {
+            // one serial cycle past the rejected request
+            clock = mch->drive(source, clock, clock + 1, options.event_driven, false);
+        }
+    }
+    
+    // a record read but not added yet is where a restored run goes on
+    position.clock  = clock;
+    position.id     = source.id - source.pending();
+    position.offset = trace->tell() - source.pending();
+    
+    return clock;
+}
+
+/** What each measured window of a sampled run saw. */
+struct Samples {
+    std::vector<double> cycles;
+    std::vector<double> readCount;
+    std::vector<double> readLatency; /**< Sum of the latencies. */
+    std::vector<double> writeCount;
+    std::vector<double> writeLatency;
+};
+
+/** Mean of a ratio over samples, sum(values)/sum(weights), and the half
+ *  width of its 95% confidence interval. */
+static void estimate(const std::vector<double> &values, const std::vector<double> &weights,
+    double &mean, double &error)
+{
+    size_t n = values.size();
+    double value = 0, weight = 0, deviation = 0;
+    
+    for (size_t i=0; i<n; ++i) {
+        value  += values[i];
+        weight += weights[i];
+    }
+    mean = weight > 0 ? value/weight : 0;
+    
+    for (size_t i=0; i<n; ++i) {
+        double residual = values[i] - mean*weights[i];
+        deviation += residual*residual;
+    }
+    error = n > 1 && weight > 0 ? 1.96*sqrt(deviation/(n*(n-1)))/(weight/n) : 0;
+}
+
+/** Run the requests of a trace file in sampling mode, SMARTS style: most of
+ *  each period only warms up open rows and refreshes, functionally, and its
+ *  end is simulated in detail and measured; return the final clock. */
+static int64_t sample(MemoryControllerHub *mch, Trace::Reader *trace, const Options &options,
+    Samples &samples)
+{
+    TraceSource source(trace);
+    int64_t clock = 0, time;
+    for (int64_t period = 0; source.front(time) && clock < options.max_clock; period += options.period) {
+        int64_t start = std::max(clock, period + options.period - options.window - options.warmup);
+        int64_t measure = start + options.warmup, end = measure + options.window;
+        if (end > options.max_clock) break;
+        
+        // Functional warm-up, including requests held back by the last drain
+        for (const Submission *request; (request = source.front(time)) && time < start; source.pop()) {
+            mch->warm(time, request->address);
+            clock = std::max(clock, time);
+        }
+        if (!source.front(time)) break;
+        mch->warm(start);
+        
+        // Detailed warm-up, then the measured window
+        Statistics before = Statistics(), after = Statistics();
+        clock = mch->drive(source, start, measure, options.event_driven, true);
+        mch->getStatistics(before);
+        clock = mch->drive(source, clock, end, options.event_driven, true);
+        mch->getStatistics(after);
+        
+        samples.cycles.push_back(end - measure);
+        samples.readCount.push_back(after.readCount - before.readCount);
+        samples.readLatency.push_back(after.readLatency - before.readLatency);
+        samples.writeCount.push_back(after.writeCount - before.writeCount);
+        samples.writeLatency.push_back(after.writeLatency - before.writeLatency);
+        
+        // Drain, as warming up needs the channels idle
+        while (!mch->is_idle() && clock < options.max_clock) {
+            mch->cycle(clock);
+            clock = options.event_driven ? std::min(mch->getNextEventTime(clock), options.max_clock) : clock + 1;
+        }
+    }
+    
+    // the rest of the trace runs past max_clock
+    return source.front(time) ? options.max_clock : clock;
+}
+
+/** Save the hub and the position of a replay to path, or restore them
+ *  from it; false on error. */
+static bool checkpoint(const char *path, bool saving, MemoryControllerHub *mch, Position &position)
+{
+    Checkpoint *checkpoint = saving ? Checkpoint::create(path) : Checkpoint::open(path);
+    if (checkpoint == NULL) return false;
+    
+    checkpoint->io(position);
+    bool ok = mch->checkpoint(*checkpoint) && checkpoint->close();
+    delete checkpoint;
+    
+    return ok;
+}
+
+/** Hands completed requests back to the producer, waiting for room if need be. */
+class SharedListener : public Memory::Listener
+{
+public:
+    Trace::SharedMemory *shared;
+    
+    SharedListener(Trace::SharedMemory *_shared) : shared(_shared) {}
+    
+    void complete(const Memory::Completion &completion) {
+        while (!shared->complete(completion)) sched_yield();
+    }
+};
+
+/** The requests a producer puts in shared memory, numbered in order. */
+class SharedSource : public RequestSource
+{
+protected:
+    bool fetch(Submission &request, int64_t &time, int64_t &horizon) {
+        Trace::Record record;
+        if (!shared->pop(record)) {
+            horizon = shared->is_finished() ? INT64_MAX : shared->getHorizon();
+            return false;
+        }
+        
+        request.id = id++;
+        request.address = record.address;
+        request.is_write = record.is_write();
+        request.source = record.source;
+        time = record.time;
+        
+        return true;
+    }
+
+public:
+    Trace::SharedMemory *shared;
+    uint64_t id; /**< Id of the next request taken. */
+    
+    SharedSource(Trace::SharedMemory *_shared) : shared(_shared), id(0) {}
+};
+
+/** Run the requests of a producer in shared memory, return the final clock.
+ *  Once the producer closes, run until every request has completed. */
+static int64_t serve(MemoryControllerHub *mch, Trace::SharedMemory *shared, const Options &options)
+{
+    SharedListener listener(shared);
+    SharedSource source(shared);
+    
+    mch->setListener(&listener);
+    int64_t clock = mch->drive(source, 0, options.max_clock, options.event_driven, true);
+    mch->setListener(NULL);
+    
+    return clock;
+}
+
+/** Keeps the latency of every request, by id. */
+class LatencyListener : public Memory::Listener
+{
+public:
+    std::vector<int64_t> latencies; /**< -1 for ids not seen. */
+    
+    void complete(const Memory::Completion &completion) {
+        if (completion.id >= latencies.size()) latencies.resize(completion.id+1, -1);
+        latencies[completion.id] = completion.releaseTime - completion.allocateTime;
+    }
+};
+
+/** Run the requests of a trace through the analytical model, return the
+ *  final clock and the requests it took per second in rate. */
+static int64_t runModel(LatencyModel *model, Trace::Reader *trace, const Options &options, double &rate)
+{
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    
+    const Trace::Record *record;
+    uint64_t id = 0;
+    while ((record = trace->next()) && (int64_t)record->time < options.max_clock) {
+        model->addRequest(record->time, record->address, record->is_write(), id, record->source);
+        id += 1;
+    }
+    
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    double seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec)*1e-9;
+    rate = seconds > 0 ? id/seconds : 0;
+    
+    return model->getClock();
+}
+
+/** Relative error of a model value against the hub, in percent. */
+static double deviation(double model, double hub)
+{
+    return hub != 0 ? 100*(model - hub)/hub : 0;
+}
+
+/** Report how the model compares to the hub on the same trace, in all
+ *  and request by request. */
+static void calibrate(Statistics &model, Statistics &hub,
+    LatencyListener &modelLatencies, LatencyListener &hubLatencies)
+{
+    double modelRead  = model.readCount ? (double)model.readLatency/model.readCount : 0;
+    double hubRead    = hub.readCount ? (double)hub.readLatency/hub.readCount : 0;
+    double modelWrite = model.writeCount ? (double)model.writeLatency/model.writeCount : 0;
+    double hubWrite   = hub.writeCount ? (double)hub.writeLatency/hub.writeCount : 0;
+    
+    // requests that completed in both
+    uint64_t count = 0;
+    double bias = 0, absolute = 0;
+    size_t n = std::min(modelLatencies.latencies.size(), hubLatencies.latencies.size());
+    for (size_t i=0; i<n; ++i) {
+        int64_t estimated = modelLatencies.latencies[i], simulated = hubLatencies.latencies[i];
+        if (estimated < 0 || simulated < 0) continue;
+        
+        count += 1;
+        bias += estimated - simulated;
+        absolute += std::abs(estimated - simulated);
+    }
+    
+    std::cout << "model_read_latency: " << modelRead << "\n"
+              << "model_read_latency_error: " << deviation(modelRead, hubRead) << "%\n"
+              << "model_write_latency: " << modelWrite << "\n"
+              << "model_write_latency_error: " << deviation(modelWrite, hubWrite) << "%\n";
+    static const CommandType types[] = {COMMAND_activate, COMMAND_precharge, COMMAND_refresh,
+        COMMAND_refresh_bank};
+    static const char *mne[] = {"act", "pre", "refresh", "refresh_bank"};
+    for (int i=0; i<4; ++i) {
+        std::cout << "model_command_" << mne[i] << ": " << model.commandCount[types[i]] << "\n"
+                  << "model_command_" << mne[i] << "_error: "
+                  << deviation(model.commandCount[types[i]], hub.commandCount[types[i]]) << "%\n";
+    }
+    std::cout << "model_compared: " << count << "\n"
+              << "model_latency_bias: " << (count ? bias/count : 0) << "\n"
+              << "model_latency_mae: " << (count ? absolute/count : 0) << "\n";
+}
+
+/** Mean read latency of each source of records, by the latencies of
+ *  listener, which lists them by index; 0 for sources without any. */
+static void sourceLatencies(const std::vector<Trace::Record> &records, const LatencyListener &listener,
+    std::vector<double> &latencies)
+{
+    std::vector<uint64_t> counts;
+    latencies.clear();
+    for (size_t id=0; id<records.size() && id<listener.latencies.size(); ++id) {
+        const Trace::Record &record = records[id];
+        if (record.is_write() || listener.latencies[id] < 0) continue;
+        
+        if (record.source >= latencies.size()) {
+            latencies.resize(record.source+1, 0);
+            counts.resize(record.source+1, 0);
+        }
+        latencies[record.source] += listener.latencies[id];
+        counts[record.source] += 1;
+    }
+    
+    for (size_t source=0; source<latencies.size(); ++source) {
+        if (counts[source]) latencies[source] /= counts[source];
+    }
+}
+
+/** Run the requests of each source of records alone, and report how much
+ *  slower its reads were together, as shared saw them: the slowdown of
+ *  each source, the weighted speedup, which sums their inverses, and the
+ *  largest slowdown. */
+static void fairness(Config *config, const std::vector<Trace::Record> &records, const LatencyListener &shared,
+    const Options &options, std::ostream &output)
+{
+    std::vector<double> together, alone;
+    sourceLatencies(records, shared, together);
+    
+    double speedup = 0, worst = 0;
+    for (size_t source=0; source<together.size(); ++source) {
+        if (together[source] == 0) continue;
+        
+        std::vector<Trace::Record> own;
+        for (size_t i=0; i<records.size(); ++i) {
+            if (records[i].source == source) own.push_back(records[i]);
+        }
+        
+        MemoryControllerHub mch(config, !options.runtime);
+        LatencyListener listener;
+        mch.setListener(&listener);
+        Trace::MemoryReader trace(own.data(), own.data() + own.size());
+        Position position = Position();
+        replay(&mch, NULL, &trace, options, position);
+        
+        sourceLatencies(own, listener, alone);
+        if (alone[source] == 0) continue;
+        
+        double slowdown = together[source]/alone[source];
+        output << "source_" << source << "_slowdown: " << slowdown << "\n";
+        speedup += 1/slowdown;
+        worst = std::max(worst, slowdown);
+    }
+    
+    output << "weighted_speedup: " << speedup << "\n"
+           << "max_slowdown: " << worst << "\n";
+}
+
+/** Settings to sweep: every combination of the values of each key. */
+struct Grid {
+    std::vector<std::string> keys;
+    std::vector<std::vector<int> > values;
+    
+    size_t size() {
+        size_t size = 1;
+        for (size_t i=0; i<values.size(); ++i) size *= values[i].size();
+        return size;
+    }
+    
+    /** Override settings with point index, the last key varying fastest. */
+    void point(size_t index, std::map<std::string, int> &settings) {
+        for (size_t i=keys.size(); i-- > 0; ) {
+            settings[keys[i]] = values[i][index % values[i].size()];
+            index /= values[i].size();
+        }
+    }
+};
+
+/** Read a grid of "key = value, value, ..." lines, with keys of settings
+ *  and # starting a comment; false on error, which is reported. */
+static bool readGrid(const char *path, std::map<std::string, int> &settings, Grid &grid)
+{
+    std::ifstream file(path);
+    if (!file) {
+        fprintf(stderr, "cannot read grid %s\n", path);
+        return false;
+    }
+    
+    std::string line;
+    for (int number = 1; std::getline(file, line); ++number) {
+        line = line.substr(0, line.find('#'));
+        std::replace(line.begin(), line.end(), '=', ' ');
+        std::replace(line.begin(), line.end(), ',', ' ');
+        
+        std::istringstream fields(line);
+        std::string key;
+        if (!(fields >> key)) continue;
+        
+        std::vector<int> values;
+        for (int value; fields >> value; ) values.push_back(value);
+        if (settings.count(key) == 0 || values.empty() || !fields.eof()) {
+            fprintf(stderr, "%s:%d: bad setting %s\n", path, number, key.c_str());
+            return false;
+        }
+        
+        grid.keys.push_back(key);
+        grid.values.push_back(values);
+    }
+    
+    return true;
+}
+
+/** Run every point of a grid over the records of a trace, each with a
+ *  hub of its own on a pool of threads, and leave the output of each in
+ *  results, a "key: value" line per column. */
+static void sweep(Grid &grid, const std::vector<Trace::Record> &records, const Options &options,
+    std::vector<std::string> &results)
+{
+    ThreadPool pool(options.threads);
+    
+    results.assign(grid.size(), std::string());
+    // a point is a whole run, so idle threads taking the next one is balance enough
+    pool.run(grid.size(), [&](int index) {
+        std::map<std::string, int> settings;
+        getSettings(settings);
+        grid.point(index, settings);
+        
+        Config config(settings);
+        Trace::MemoryReader trace(records.data(), records.data() + records.size());
+        Statistics stats = Statistics();
+        LatencyListener latencies;
+        int64_t clock;
+        if (options.model) {
+            LatencyModel model(&config);
+            double rate;
+            clock = runModel(&model, &trace, options, rate);
+            model.getStatistics(stats);
+        } else {
+            MemoryControllerHub mch(&config, !options.runtime);
+            if (options.fairness) mch.setListener(&latencies);
+            Position position = Position();
+            clock = replay(&mch, NULL, &trace, options, position);
+            mch.getStatistics(stats);
+        }
+        
+        std::ostringstream output;
+        for (size_t i=0; i<grid.keys.size(); ++i) {
+            output << grid.keys[i] << ": " << settings[grid.keys[i]] << "\n";
+        }
+        output << "clock: " << clock << "\n" << stats;
+        if (options.fairness) fairness(&config, records, latencies, options, output);
+        results[index] = output.str();
+    });
+}
+
+/** Print the results of a sweep as a CSV table, or as a JSON array of
+ *  objects, with the columns of the first one. */
+static void printSweep(const std::vector<std::string> &results, bool json)
+{
+    std::vector<std::string> columns;
+    std::istringstream first(results.empty() ? std::string() : results[0]);
+    for (std::string line; std::getline(first, line); ) {
+        columns.push_back(line.substr(0, line.find(": ")));
+    }
+    
+    if (json) {
+        std::cout << "[\n";
+    } else {
+        for (size_t i=0; i<columns.size(); ++i) {
+            std::cout << (i ? "," : "") << columns[i];
+        }
+        std::cout << "\n";
+    }
+    
+    for (size_t row=0; row<results.size(); ++row) {
+        std::istringstream result(results[row]);
+        std::string line;
+        if (json) std::cout << "  {";
+        for (size_t i=0; std::getline(result, line); ++i) {
+            std::string value = line.substr(line.find(": ") + 2);
+            if (json) {
+                std::cout << (i ? ", " : "") << "\"" << columns[i] << "\": " << value;
+            } else {
+                std::cout << (i ? "," : "") << value;
+            }
+        }
+        if (json) {
+            std::cout << (row+1 < results.size() ? "},\n" : "}\n");
+        } else {
+            std::cout << "\n";
+        }
+    }
+    
+    if (json) std::cout << "]\n";
+}
+
+/** Run the requests of a trace on a thread of the hub's own, as an
+ *  embedding host would, return the final clock. */
+static int64_t runAhead(MemoryControllerHub *mch, Trace::Reader *trace, const Options &options)
+{
+    // stop at the last request, as replay() does
+    AsyncMemoryControllerHub amch(mch, 1 << 12, options.event_driven, options.max_clock, false);
+    
+    Memory::Completion completions[64];
+    const Trace::Record *record = trace->next();
+    uint64_t id = 0;
+    // the simulation may end at max_clock before the trace does
+    while (record && !amch.is_finished()) {
+        if (amch.addRequest(record->time, record->address, record->is_write(), id, record->source)) {
+            record = trace->next();
+            id += 1;
+        } else {
+            sched_yield();
+        }
+        // a host would act on these at their release time
+        amch.pollCompletions(completions, 64);
+    }
+    amch.close();
+    
+    while (!amch.is_finished()) {
+        if (amch.pollCompletions(completions, 64) == 0) sched_yield();
+    }
+    
+    return amch.finish();
+}
+
 int main(int argc, char *argv[])
 {
+    const char *usage = "usage: %s [-e] [-r] [-j threads] [-E epoch] [-s | -a] [-L checkpoint] [-C checkpoint] [-S period:window[:warmup]] [-m | -c] [-G grid [-F csv|json]] [-f] trace max_clock\n";
+    Options options = Options();
+    options.threads = 1;
+    options.epoch = 1000;
+    
+    int opt;
+    while ((opt = getopt(argc, argv, "erj:E:saL:C:S:mcG:F:f")) != -1) {
+        switch (opt) {
+            case 'e': // skip cycles in which nothing can happen
+                options.event_driven = true;
+                break;
+            case 'r': // configure timing at run time, even for a preset
+                options.runtime = true;
+                break;
+            case 'j': // simulate channels in parallel
+                options.threads = atoi(optarg);
+                break;
+            case 'E': // cycles between synchronizations of parallel channels
+                options.epoch = atoi(optarg);
+                break;
+            case 's': // trace names shared memory filled by another process
+                options.shared = true;
+                break;
+            case 'a': // simulate on a thread of its own, ahead of the trace reader
+                options.async = true;
+                break;
+            case 'L': // restore the state saved by -C, and go on from there
+                options.restore = optarg;
+                break;
+            case 'C': // save the state at max_clock, to resume or fork runs from
+                options.save = optarg;
+                break;
+            case 'S': // sample windows of cycles, warming up functionally in between
+                options.warmup = -1;
+                if (sscanf(optarg, "%" SCNd64 ":%" SCNd64 ":%" SCNd64,
+                    &options.period, &options.window, &options.warmup) < 2) {
+                    options.period = -1;
+                }
+                if (options.warmup == -1) options.warmup = options.window;
+                break;
+            case 'm': // estimate latencies with the analytical model instead,
+                      // which serves each bank in order; check with -c first
+                options.model = true;
+                break;
+            case 'c': // also run the analytical model, and compare it to the hub
+                options.calibrate = true;
+                break;
+            case 'G': // sweep a grid of settings over the trace, a run per point on -j threads
+                options.grid = optarg;
+                break;
+            case 'F': // table format of a sweep
+                if (strcmp(optarg, "json") == 0) {
+                    options.json = true;
+                } else if (strcmp(optarg, "csv") != 0) {
+                    fprintf(stderr, usage, argv[0]);
+                    return 1;
+                }
+                break;
+            case 'f': // report the slowdown of each source, running each alone too
+                options.fairness = true;
+                break;
+            default:
+                fprintf(stderr, usage, argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind < 2 || options.threads < 1 || options.epoch < 1 ||
+        (options.shared && options.threads > 1) || (options.shared && options.async) ||
+        (options.async && options.threads > 1) ||
+        ((options.save || options.restore) && (options.shared || options.async)) ||
+        (options.period != 0 && (options.window < 1 || options.warmup < 0 ||
+            options.period < options.window + options.warmup ||
+            options.shared || options.async || options.threads > 1 || options.save || options.restore)) ||
+        ((options.model || options.calibrate) && (options.model == options.calibrate ||
+            options.shared || options.async || options.threads > 1 || options.period != 0 ||
+            options.save || options.restore)) ||
+        (options.grid && (options.shared || options.async || options.period != 0 ||
+            options.calibrate || options.save || options.restore)) ||
+        (options.fairness && (options.shared || options.async || options.period != 0 ||
+            options.model || options.calibrate || options.save || options.restore ||
+            (options.threads > 1 && !options.grid)))) {
+        fprintf(stderr, usage, argv[0]);
+        return 1;
+    }
+    options.max_clock = strtoll(argv[optind+1], NULL, 10);
+    
     std::map<std::string, int> settings;
     getSettings(settings);
     
+    // parsed once for all runs
+    std::vector<Trace::Record> records;
+    if (options.grid || options.fairness) {
+        Trace::Reader *trace = Trace::Reader::open(argv[optind]);
+        if (trace == NULL) {
+            fprintf(stderr, "%s: cannot read trace %s\n", argv[0], argv[optind]);
+            return 1;
+        }
+        for (const Trace::Record *record; (record = trace->next()); ) {
+            records.push_back(*record);
+        }
+        delete trace;
+    }
+    
+    if (options.grid) {
+        Grid grid;
+        if (!readGrid(options.grid, settings, grid)) return 1;
+        
+        std::vector<std::string> results;
+        sweep(grid, records, options, results);
+        printSweep(results, options.json);
+        
+        return 0;
+    }
+    
     Config *config = new Config(settings);    
-    MemoryControllerHub *mch = new MemoryControllerHub(config);
-    
-    FILE* file = fopen(argv[1], "r");
-    uint32_t max_clock = atoi(argv[2]);
-    
-    uint32_t address;
-    char command[64], line[256];
-    uint32_t clock, time, epoch;
-    bool is_write;
-    clock = epoch = 0;
-    while(fgets(line, sizeof(line), file) && clock < max_clock) {
-        sscanf(line, "0x%x %s %d", &address, command, &time);
-        is_write = strcmp(command, "WRITE") == 0 
-            || strcmp(command, "P_MEM_WR") == 0 
-            || strcmp(command, "BOFF") == 0;
-        while (clock < max_clock && (clock < time || !mch->addRequest(clock, address, is_write))) {
-            mch->cycle(clock);
-            clock += 1;
+    MemoryControllerHub *mch;
+    ParallelMemoryControllerHub *pmch = NULL;
+    if (options.threads > 1) {
+        mch = pmch = new ParallelMemoryControllerHub(config, options.threads, !options.runtime);
+    } else {
+        mch = new MemoryControllerHub(config, !options.runtime);
+    }
+    
+    Trace::Reader *trace = NULL;
+    Trace::SharedMemory *shared = NULL;
+    if (options.shared) {
+        shared = Trace::SharedMemory::attach(argv[optind]);
+    } else if (options.fairness) {
+        trace = new Trace::MemoryReader(records.data(), records.data() + records.size());
+    } else {
+        trace = Trace::Reader::open(argv[optind]);
+    }
+    if (trace == NULL && shared == NULL) {
+        fprintf(stderr, "%s: cannot read trace %s\n", argv[0], argv[optind]);
+        return 1;
+    }
+    
+    Position position = Position();
+    if (options.restore && (!checkpoint(options.restore, false, mch, position) ||
+                            !trace->seek(position.offset))) {
+        fprintf(stderr, "%s: cannot restore checkpoint %s\n", argv[0], options.restore);
+        return 1;
+    }
+    
+    // a calibration runs the model on a reader of its own, ahead of the hub
+    LatencyModel *model = NULL;
+    LatencyListener modelLatencies, hubLatencies;
+    double rate = 0;
+    int64_t modelClock = 0;
+    if (options.model || options.calibrate) {
+        Trace::Reader *modelTrace = options.calibrate ? Trace::Reader::open(argv[optind]) : trace;
+        if (modelTrace == NULL) {
+            fprintf(stderr, "%s: cannot read trace %s\n", argv[0], argv[optind]);
+            return 1;
+        }
+        
+        model = new LatencyModel(config);
+        if (options.calibrate) {
+            model->setListener(&modelLatencies);
+            mch->setListener(&hubLatencies);
+        }
+        modelClock = runModel(model, modelTrace, options, rate);
+        
+        if (modelTrace != trace) delete modelTrace;
+    }
+    if (options.fairness) mch->setListener(&hubLatencies);
+    
+    int64_t clock;
+    Samples samples;
+    if (options.model) {
+        clock = modelClock;
+    } else if (shared) {
+        clock = serve(mch, shared, options);
+    } else if (options.async) {
+        clock = runAhead(mch, trace, options);
+    } else if (options.period) {
+        clock = sample(mch, trace, options, samples);
+    } else {
+        clock = replay(mch, pmch, trace, options, position);
+    }
+    
+    if (options.save && !checkpoint(options.save, true, mch, position)) {
+        fprintf(stderr, "%s: cannot save checkpoint %s\n", argv[0], options.save);
+        return 1;
+    }
+    
+
+    Statistics stats = Statistics();
+    if (options.model) {
+        model->getStatistics(stats);
+    } else {
+        mch->getStatistics(stats);
+    }
+    std::cout << "clock: " << clock << "\n" << stats;
+    if (trace && trace->getParseRate() > 0) {
+        std::cout << "parse_rate: " << trace->getParseRate() << " MB/s\n";
+    }
+    if (options.period) {
+        // bandwidth in bytes per cycle, each request moving a line
+        std::vector<double> bytes;
+        for (size_t i=0; i<samples.cycles.size(); ++i) {
+            bytes.push_back((samples.readCount[i] + samples.writeCount[i])*(1 << settings["line"]));
         }
+        
+        double mean, error;
+        std::cout << "sample_windows: " << samples.cycles.size() << "\n";
+        estimate(samples.readLatency, samples.readCount, mean, error);
+        std::cout << "sample_read_latency: " << mean << "\n"
+                  << "sample_read_latency_ci95: " << error << "\n";
+        estimate(samples.writeLatency, samples.writeCount, mean, error);
+        std::cout << "sample_write_latency: " << mean << "\n"
+                  << "sample_write_latency_ci95: " << error << "\n";
+        estimate(bytes, samples.cycles, mean, error);
+        std::cout << "sample_bandwidth: " << mean << " B/cycle\n"
+                  << "sample_bandwidth_ci95: " << error << " B/cycle\n";
     }
+    if (options.fairness) {
+        fairness(config, records, hubLatencies, options, std::cout);
+    }
+    if (model) {
+        if (options.calibrate) {
+            Statistics estimated = Statistics();
+            model->getStatistics(estimated);
+            calibrate(estimated, stats, modelLatencies, hubLatencies);
+        }
     
-    fclose(file);
+        uint64_t hits, misses, conflicts;
+        model->getRowStatistics(hits, misses, conflicts);
+        std::cout << "model_row_hits: " << hits << "\n"
+                  << "model_row_misses: " << misses << "\n"
+                  << "model_row_conflicts: " << conflicts << "\n"
+                  << "model_rate: " << rate/1e6 << " M requests/s\n";
+    }
     
+    delete model;
+    delete shared;
+    delete trace;
     delete mch;
     delete config;
     
@@ -47,6 +820,7 @@ void getSettings(std::map<std::string, int> &settings)
 {
     settings["request"]     = 32;
     settings["transaction"] = 32;
+    settings["write"]       = 0;
     settings["command"]     = 32;
     
     settings["channel"] = 0;
@@ -56,10 +830,44 @@ void getSettings(std::map<std::string, int> &settings)
     settings["column"]  = 7;
     settings["line"]    = 6;
     
+    // address fields from the lowest bits up: 1 channel, 2 column, 3 rank,
+    // 4 bank, 5 row; the *_xor fields hash in the lowest bits of another
+    // field, such as 5 for the row, or are 0 for none
+    settings["mapping"]     = 12345;
+    settings["channel_xor"] = 0;
+    settings["bank_xor"]    = 0;
+    
     settings["device"] = 8;
     
     settings["max_row_idle"] = 0;
     settings["max_row_hits"] = 5;
+    // page policy: 0 open, 1 close, 2 hybrid, closing rows with
+    // auto-precharge on the last pending hit, 3 adaptive, as hybrid but
+    // keeping rows open that each bank predicts to be hit next
+    settings["page_policy"]  = 0;
+    settings["write_high"]   = 0;
+    settings["write_low"]    = 0;
+    
+    // refreshes that may be postponed while busy and pulled in while
+    // idle, up to 8 each, and whether to refresh one bank at a time
+    settings["refresh_postpone"] = 0;
+    settings["refresh_pullin"]   = 0;
+    settings["refresh_per_bank"] = 0;
+    
+    // idle cycles before a rank powers down, 0 for at once, and before it
+    // enters self-refresh, 0 for never; active power-down leaves rows open
+    settings["powerdown_idle"]   = 0;
+    settings["powerdown_active"] = 0;
+    settings["selfrefresh_idle"] = 0;
+    
+    // scheduler: 0 FR-FCFS, 1 PAR-BS, 2 ATLAS, 3 BLISS, among source
+    // sources of the trace, the others folding onto them
+    settings["scheduler"]          = 0;
+    settings["source"]             = 1;
+    settings["marking_cap"]        = 5;
+    settings["quantum"]            = 10000;
+    settings["blacklist_streak"]   = 4;
+    settings["blacklist_interval"] = 10000;
     
     settings["tTQ"]   = 0;
     settings["tCQ"]   = 0;
@@ -84,6 +892,9 @@ void getSettings(std::map<std::string, int> &settings)
     settings["tFAW"]  = 16;
     settings["tCKE"]  = 3;
     settings["tXP"]   = 3;
+    settings["tRFCpb"] = 28;
+    settings["tCKESR"] = 4;
+    settings["tXS"]    = 72;
     
     settings["IDD0"]=100;
     settings["IDD1"]=115;
@@ -1,3 +1,6 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
 #include "configure.h"
 
 namespace Memory {
@@ -8,18 +11,49 @@ struct BitField {
     
     /** Retrieve value from address. */
     uint64_t value(uint64_t address) {
-        return (address >> offset) & ((1 << width) - 1);
+        return (address >> offset) & (((uint64_t)1 << width) - 1);
     }
     
     /** Retrieve value from filtering address. */
     uint64_t filter(uint64_t address) {
-        return address & (((1 << width) - 1) << offset);
+        return address & mask();
+    }
+    
+    /** Bits of the address holding the value. */
+    uint64_t mask() {
+        return (((uint64_t)1 << width) - 1) << offset;
     }
 };
 
+/** A request submitted in a batch. */
+struct Submission {
+    uint64_t id;
+    uint64_t address;
+    bool is_write;
+    uint16_t source;
+};
+
+/** A request served by a memory. */
+struct Completion {
+    uint64_t id;
+    uint64_t address;
+    int64_t allocateTime;
+    int64_t releaseTime;
+};
+
+/** Receiver of the requests a memory completes. */
+class Listener {
+public:
+    virtual ~Listener() {}
+    virtual void complete(const Completion &completion) = 0;
+};
+
 class Memory {
 public:
-    virtual bool addRequest(int64_t clock, uint64_t address, bool is_write) = 0;
+    virtual bool addRequest(int64_t clock, uint64_t address, bool is_write, uint64_t id = 0,
+        uint16_t source = 0) = 0;
+};
+
 };
 
-};
\ No newline at end of file
+#endif
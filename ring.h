@@ -0,0 +1,120 @@
+#ifndef RING_H
+#define RING_H
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <stdint.h>
+
+/** Lock-free ring between one producer and one consumer thread.
+ *  It lives in memory given by the caller, which may be shared between
+ *  processes, so it holds no pointers of its own. */
+template<class DataType>
+class Ring
+{
+protected:
+    /** Shared state, with each index on its own cache line. */
+    struct Control {
+        std::atomic<uint64_t> head; // next slot to pop, written by the consumer
+        char headPad[64 - sizeof(std::atomic<uint64_t>)];
+        std::atomic<uint64_t> tail; // next slot to push, written by the producer
+        char tailPad[64 - sizeof(std::atomic<uint64_t>)];
+        uint64_t size;
+    };
+    
+    Control *m_control;
+    DataType *m_data;
+    uint64_t m_mask;
+    
+    // last index seen of the other side, saves touching its cache line
+    uint64_t m_head;
+    uint64_t m_tail;
+
+public:
+    /** Bytes of memory needed for size slots. */
+    static size_t bytes(size_t size) {
+        return (sizeof(Control) + 63)/64*64 + size*sizeof(DataType);
+    }
+    
+    /** Use memory for size slots, size a power of 2. Only one side
+     *  initializes it, before the other one attaches. */
+    Ring(void *memory, size_t size, bool initialize) {
+        assert(size > 0 && (size & (size-1)) == 0);
+        assert(std::atomic<uint64_t>().is_lock_free());
+        
+        m_control = (Control *)memory;
+        m_data = (DataType *)((char *)memory + (sizeof(Control) + 63)/64*64);
+        m_mask = size-1;
+        
+        if (initialize) {
+            m_control->head.store(0, std::memory_order_relaxed);
+            m_control->tail.store(0, std::memory_order_relaxed);
+            m_control->size = size;
+        }
+        assert(m_control->size == size);
+        
+        m_head = m_control->head.load(std::memory_order_acquire);
+        m_tail = m_control->tail.load(std::memory_order_acquire);
+    }
+    
+    /** Producer side, false if the ring is full. */
+    bool push(const DataType &data) {
+        uint64_t tail = m_control->tail.load(std::memory_order_relaxed);
+        
+        if (tail - m_head > m_mask) {
+            m_head = m_control->head.load(std::memory_order_acquire);
+            if (tail - m_head > m_mask) return false;
+        }
+        
+        m_data[tail & m_mask] = data;
+        m_control->tail.store(tail+1, std::memory_order_release);
+        
+        return true;
+    }
+    
+    /** Consumer side, false if the ring is empty. */
+    bool pop(DataType &data) {
+        uint64_t head = m_control->head.load(std::memory_order_relaxed);
+        
+        if (head == m_tail) {
+            m_tail = m_control->tail.load(std::memory_order_acquire);
+            if (head == m_tail) return false;
+        }
+        
+        data = m_data[head & m_mask];
+        m_control->head.store(head+1, std::memory_order_release);
+        
+        return true;
+    }
+    
+    /** Consumer side, pop up to count slots at once; how many were popped. */
+    size_t pop(DataType *data, size_t count) {
+        uint64_t head = m_control->head.load(std::memory_order_relaxed);
+        
+        if (m_tail - head < count) {
+            m_tail = m_control->tail.load(std::memory_order_acquire);
+            if (m_tail - head < count) count = m_tail - head;
+        }
+        
+        for (size_t i=0; i<count; ++i) {
+            data[i] = m_data[(head+i) & m_mask];
+        }
+        m_control->head.store(head+count, std::memory_order_release);
+        
+        return count;
+    }
+    
+    /** Consumer side, true if nothing is left to pop. */
+    bool is_empty() {
+        uint64_t head = m_control->head.load(std::memory_order_relaxed);
+        m_tail = m_control->tail.load(std::memory_order_acquire);
+        
+        return head == m_tail;
+    }
+    
+    size_t size() {
+        return m_mask+1;
+    }
+};
+
+#endif
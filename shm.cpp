@@ -0,0 +1,165 @@
+#include "shm.h"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace Trace;
+
+static const char segmentMagic[8] = {'D', 'R', 'A', 'M', 'S', 'H', 'M', '\0'};
+
+static inline size_t align(size_t bytes)
+{
+    return (bytes + 63)/64*64;
+}
+
+size_t SharedMemory::bytes(size_t size)
+{
+    return align(sizeof(Segment)) +
+        align(Ring<Record>::bytes(size)) +
+        align(Ring<Memory::Completion>::bytes(size));
+}
+
+SharedMemory::SharedMemory(const char *_name, bool _owner, void *_base, size_t _length, bool initialize) :
+    name(_name),
+    owner(_owner),
+    base(_base),
+    length(_length)
+{
+    segment = (Segment *)base;
+    
+    char *rings = (char *)base + align(sizeof(Segment));
+    size_t size = segment->size;
+    requests = new Ring<Record>(rings, size, initialize);
+    completions = new Ring<Memory::Completion>(
+        rings + align(Ring<Record>::bytes(size)), size, initialize);
+}
+
+SharedMemory::~SharedMemory()
+{
+    if (!owner) stop();
+    
+    delete completions;
+    delete requests;
+    
+    munmap(base, length);
+    if (owner) shm_unlink(name.c_str());
+}
+
+SharedMemory *SharedMemory::create(const char *name, size_t size)
+{
+    if (size == 0 || (size & (size-1)) != 0) return NULL;
+    
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd == -1) return NULL;
+    
+    size_t length = bytes(size);
+    if (ftruncate(fd, length) == -1) {
+        ::close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    
+    void *base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+        shm_unlink(name);
+        return NULL;
+    }
+    
+    Segment *segment = (Segment *)base;
+    segment->version = version;
+    segment->reserved = 0;
+    segment->size = size;
+    segment->horizon.store(0, std::memory_order_relaxed);
+    segment->closed.store(0, std::memory_order_relaxed);
+    segment->stopped.store(0, std::memory_order_relaxed);
+    
+    SharedMemory *shared = new SharedMemory(name, true, base, length, true);
+    
+    // the magic goes last, an attaching consumer sees a complete segment
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(segment->magic, segmentMagic, sizeof(segmentMagic));
+    
+    return shared;
+}
+
+SharedMemory *SharedMemory::attach(const char *name)
+{
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd == -1) return NULL;
+    
+    struct stat st;
+    Segment header;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(Segment) ||
+        pread(fd, &header, sizeof(Segment), 0) != sizeof(Segment) ||
+        memcmp(header.magic, segmentMagic, sizeof(segmentMagic)) != 0 ||
+        header.version != version || (size_t)st.st_size != bytes(header.size)) {
+        ::close(fd);
+        return NULL;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    
+    size_t length = st.st_size;
+    void *base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) return NULL;
+    
+    return new SharedMemory(name, false, base, length, false);
+}
+
+
+
+bool SharedMemory::push(const Record &record)
+{
+    return requests->push(record);
+}
+
+void SharedMemory::setHorizon(int64_t horizon)
+{
+    segment->horizon.store(horizon, std::memory_order_release);
+}
+
+void SharedMemory::close()
+{
+    segment->closed.store(1, std::memory_order_release);
+}
+
+bool SharedMemory::poll(Memory::Completion &completion)
+{
+    return completions->pop(completion);
+}
+
+bool SharedMemory::is_stopped()
+{
+    return segment->stopped.load(std::memory_order_acquire);
+}
+
+
+
+bool SharedMemory::pop(Record &record)
+{
+    return requests->pop(record);
+}
+
+int64_t SharedMemory::getHorizon()
+{
+    return segment->horizon.load(std::memory_order_acquire);
+}
+
+bool SharedMemory::is_finished()
+{
+    // closed is read first, anything pushed before it is in the ring by now
+    return segment->closed.load(std::memory_order_acquire) && requests->is_empty();
+}
+
+bool SharedMemory::complete(const Memory::Completion &completion)
+{
+    return completions->push(completion);
+}
+
+void SharedMemory::stop()
+{
+    segment->stopped.store(1, std::memory_order_release);
+}
@@ -0,0 +1,74 @@
+#include "memory.h"
+#include "ring.h"
+#include "trace.h"
+
+namespace Trace {
+
+/** Requests streamed from another process through POSIX shared memory.
+ *  The producer pushes records in time order and may promise a horizon,
+ *  a time no later record will come before, so that the simulation can
+ *  run up to it without waiting. Completed requests flow back on a
+ *  second ring. Each side must be a single thread. */
+class SharedMemory
+{
+protected:
+    /** Start of the segment, followed by the two rings. */
+    struct Segment {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t size;
+        std::atomic<int64_t> horizon;
+        std::atomic<uint32_t> closed;
+        std::atomic<uint32_t> stopped;
+    };
+    
+    std::string name;
+    bool owner;
+    void *base;
+    size_t length;
+    
+    Segment *segment;
+    Ring<Record> *requests;
+    Ring<Memory::Completion> *completions;
+    
+    SharedMemory(const char *_name, bool _owner, void *_base, size_t _length, bool initialize);
+    
+    static size_t bytes(size_t size);
+
+public:
+    virtual ~SharedMemory();
+    
+    /** Create a segment with size slots in each ring, size a power of 2;
+     *  NULL on error. The creator is the producer, and removes the name. */
+    static SharedMemory *create(const char *name, size_t size);
+    /** Attach to a segment made by create() as the consumer; NULL on error. */
+    static SharedMemory *attach(const char *name);
+    
+    // producer side
+    
+    /** Queue a request, false if the ring is full. */
+    bool push(const Record &record);
+    /** Promise that no request comes before horizon. */
+    void setHorizon(int64_t horizon);
+    /** Promise that no request comes at all. */
+    void close();
+    /** Take a completed request, false if there is none yet. */
+    bool poll(Memory::Completion &completion);
+    /** True once the consumer is gone, no more completions will come. */
+    bool is_stopped();
+    
+    // consumer side
+    
+    /** Take the next request, false if there is none yet. */
+    bool pop(Record &record);
+    int64_t getHorizon();
+    /** True once closed and every request has been taken. */
+    bool is_finished();
+    /** Return a completed request, false if the ring is full. */
+    bool complete(const Memory::Completion &completion);
+    /** Tell the producer that no more completions will come; done on delete. */
+    void stop();
+};
+
+};
@@ -0,0 +1,97 @@
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/** Fixed set of worker threads running batches of indexed tasks.
+ *  The calling thread takes part in each batch. */
+class ThreadPool
+{
+protected:
+    std::vector<std::thread> m_workers;
+    
+    std::mutex m_mutex;
+    std::condition_variable m_start;
+    std::condition_variable m_finish;
+    
+    std::function<void(int)> m_task;
+    std::atomic<int> m_next;
+    int m_count;
+    int m_pending;
+    uint64_t m_batch;
+    bool m_stopping;
+    
+    void work() {
+        for (int index; (index = m_next.fetch_add(1)) < m_count; ) {
+            m_task(index);
+        }
+    }
+    
+    void loop() {
+        uint64_t batch = 0;
+        
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_start.wait(lock, [&] { return m_stopping || m_batch != batch; });
+                if (m_stopping) return;
+                batch = m_batch;
+            }
+            
+            work();
+            
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (--m_pending == 0) m_finish.notify_one();
+        }
+    }
+
+public:
+    ThreadPool(int size) {
+        assert(size > 0);
+        m_next = 0;
+        m_count = 0;
+        m_pending = 0;
+        m_batch = 0;
+        m_stopping = false;
+        
+        for (int i=1; i<size; ++i) {
+            m_workers.push_back(std::thread(&ThreadPool::loop, this));
+        }
+    }
+    
+    ~ThreadPool() {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_start.notify_all();
+        for (size_t i=0; i<m_workers.size(); ++i) {
+            m_workers[i].join();
+        }
+    }
+    
+    int size() {
+        return m_workers.size()+1;
+    }
+    
+    /** Run task(0) ... task(count-1) and wait for all of them. */
+    void run(int count, std::function<void(int)> task) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_task = task;
+            m_count = count;
+            m_next = 0;
+            m_pending = m_workers.size();
+            m_batch += 1;
+        }
+        m_start.notify_all();
+        
+        work();
+        
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_finish.wait(lock, [&] { return m_pending == 0; });
+    }
+};
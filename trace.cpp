@@ -0,0 +1,400 @@
+#include "trace.h"
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace Trace;
+
+const char Trace::magic[8] = {'D', 'R', 'A', 'M', 'T', 'R', 'C', '\0'};
+
+
+
+Reader *Reader::open(const char *path)
+{
+    int fd = ::open(path, O_RDONLY);
+    if (fd == -1) return NULL;
+    
+    struct stat st;
+    Header header;
+    if (fstat(fd, &st) == -1) {
+        ::close(fd);
+        return NULL;
+    }
+    
+    if ((size_t)st.st_size < sizeof(Header) ||
+        pread(fd, &header, sizeof(Header), 0) != sizeof(Header) ||
+        memcmp(header.magic, magic, sizeof(magic)) != 0) {
+        ::close(fd);
+        
+        FILE *file = fopen(path, "r");
+        if (file == NULL) return NULL;
+        
+        return new TextReader(file);
+    }
+    
+    // count is checked by division, as count*sizeof(Record) may overflow
+    if (header.version != version || header.recordSize != sizeof(Record) ||
+        header.count > ((size_t)st.st_size - sizeof(Header))/sizeof(Record)) {
+        ::close(fd);
+        return NULL;
+    }
+    
+    size_t length = sizeof(Header) + header.count*sizeof(Record);
+    void *base = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) return NULL;
+    
+    madvise(base, length, MADV_SEQUENTIAL);
+    
+    return new BinaryReader(base, length);
+}
+
+bool Reader::seek(uint64_t offset)
+{
+    while (position < offset) {
+        if (next() == NULL) return false;
+    }
+    
+    return position == offset;
+}
+
+
+
+/** Padding after a chunk, so that vector loads never run past the buffer. */
+static const size_t padding = 16;
+
+static inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline int hexDigit(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+#ifdef __SSE2__
+/** Right-align the first n of 16 digit values, with leading zeros. */
+static inline __m128i alignDigits(__m128i digits, int n)
+{
+    char aligned[32] __attribute__((aligned(16)));
+    
+    _mm_store_si128((__m128i *)aligned, _mm_setzero_si128());
+    _mm_storeu_si128((__m128i *)(aligned + 16 - n), digits);
+    
+    return _mm_load_si128((__m128i *)aligned);
+}
+#endif
+
+/** Parse up to 16 hex digits at p, which is followed by at least 16 bytes. */
+static inline uint64_t parseHex(const char *&p)
+{
+#ifdef __SSE2__
+    __m128i text = _mm_loadu_si128((const __m128i *)p);
+    
+    // digit values, and which bytes are digits at all
+    __m128i decimal = _mm_sub_epi8(text, _mm_set1_epi8('0'));
+    __m128i alpha   = _mm_sub_epi8(_mm_or_si128(text, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i is_decimal = _mm_cmpeq_epi8(_mm_min_epu8(decimal, _mm_set1_epi8(9)), decimal);
+    __m128i is_alpha   = _mm_cmpeq_epi8(_mm_min_epu8(alpha, _mm_set1_epi8(5)), alpha);
+    __m128i digits = _mm_or_si128(
+        _mm_and_si128(is_decimal, decimal),
+        _mm_and_si128(is_alpha, _mm_add_epi8(alpha, _mm_set1_epi8(10))));
+    
+    uint32_t mask = _mm_movemask_epi8(_mm_or_si128(is_decimal, is_alpha));
+    int n = __builtin_ctz(~mask);
+    if (n < 16) {
+        p += n;
+        if (n == 0) return 0;
+        
+        // merge nibble pairs into bytes, most significant first
+        digits = alignDigits(digits, n);
+        __m128i bytes = _mm_or_si128(
+            _mm_slli_epi16(_mm_and_si128(digits, _mm_set1_epi16(0x00ff)), 4),
+            _mm_srli_epi16(digits, 8));
+        bytes = _mm_packus_epi16(bytes, bytes);
+        
+        return __builtin_bswap64(_mm_cvtsi128_si64(bytes));
+    }
+#endif
+    uint64_t value = 0;
+    for (int digit; (digit = hexDigit(*p)) >= 0; ++p) {
+        value = (value << 4) | digit;
+    }
+    
+    return value;
+}
+
+/** Parse up to 16 decimal digits at p, which is followed by at least 16 bytes. */
+static inline uint64_t parseDecimal(const char *&p)
+{
+#ifdef __SSE2__
+    __m128i text = _mm_loadu_si128((const __m128i *)p);
+    
+    __m128i digits = _mm_sub_epi8(text, _mm_set1_epi8('0'));
+    __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digits, _mm_set1_epi8(9)), digits);
+    
+    uint32_t mask = _mm_movemask_epi8(is_digit);
+    int n = __builtin_ctz(~mask);
+    if (n < 16) {
+        p += n;
+        if (n == 0) return 0;
+        
+        // combine 2, 4 and 8 digits at a time, most significant first
+        digits = alignDigits(digits, n);
+        __m128i pairs = _mm_add_epi16(
+            _mm_mullo_epi16(_mm_and_si128(digits, _mm_set1_epi16(0x00ff)), _mm_set1_epi16(10)),
+            _mm_srli_epi16(digits, 8));
+        __m128i quads = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00010064));
+        __m128i octets = _mm_add_epi64(
+            _mm_mul_epu32(quads, _mm_set1_epi32(10000)),
+            _mm_srli_epi64(quads, 32));
+        
+        uint64_t high = _mm_cvtsi128_si64(octets);
+        uint64_t low  = _mm_cvtsi128_si64(_mm_unpackhi_epi64(octets, octets));
+        
+        return high*100000000 + low;
+    }
+#endif
+    uint64_t value = 0;
+    for (; *p >= '0' && *p <= '9'; ++p) {
+        value = value*10 + (*p - '0');
+    }
+    
+    return value;
+}
+
+TextReader::TextReader(FILE *_file) :
+    file(_file)
+{
+    eof = false;
+    
+    buffer = new char[chunkSize + padding];
+    begin  = 0;
+    end    = 0;
+    
+    records = new Record[batchSize];
+    memset(records, 0, sizeof(Record)*batchSize);
+    count  = 0;
+    cursor = 0;
+}
+
+TextReader::~TextReader()
+{
+    delete [] records;
+    delete [] buffer;
+    
+    fclose(file);
+}
+
+static double elapsed(const struct timespec &start, const struct timespec &stop)
+{
+    return (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec)*1e-9;
+}
+
+/** Parse the next batch of records, reading more text as needed; the
+ *  reads are left out of the parse time. */
+bool TextReader::parse()
+{
+    struct timespec start, stop, read;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    
+    count  = 0;
+    cursor = 0;
+    
+    while (count < batchSize) {
+        const char *line = buffer + begin;
+        const char *eol = (const char *)memchr(line, '\n', end - begin);
+        
+        if (eol == NULL) {
+            if (!eof && (begin > 0 || end < chunkSize)) {
+                // keep the partial line and read the next chunk behind it
+                memmove(buffer, line, end - begin);
+                end -= begin;
+                begin = 0;
+                clock_gettime(CLOCK_MONOTONIC, &read);
+                end += fread(buffer + end, 1, chunkSize - end, file);
+                clock_gettime(CLOCK_MONOTONIC, &stop);
+                parseTime -= elapsed(read, stop);
+                eof = feof(file) || ferror(file);
+                memset(buffer + end, 0, padding);
+                continue;
+            }
+            if (begin == end) break;
+            eol = buffer + end; // last line without a newline, or an overlong one
+        }
+        
+        const char *p = line;
+        while (is_space(*p)) ++p;
+        if (p[0] == '0' && (p[1] | 0x20) == 'x') p += 2;
+        
+        if (hexDigit(*p) >= 0) {
+            Record &record = records[count++];
+            
+            record.address = parseHex(p);
+            
+            while (is_space(*p)) ++p;
+            const char *command = p;
+            while (p < eol && !is_space(*p)) ++p;
+            
+            switch (p - command) {
+                case 4:
+                    record.flags = memcmp(command, "BOFF", 4) == 0 ? FLAG_write : 0;
+                    break;
+                case 5:
+                    record.flags = memcmp(command, "WRITE", 5) == 0 ? FLAG_write : 0;
+                    break;
+                case 8:
+                    record.flags = memcmp(command, "P_MEM_WR", 8) == 0 ? FLAG_write : 0;
+                    break;
+                default:
+                    record.flags = 0;
+                    break;
+            }
+            
+            while (is_space(*p)) ++p;
+            record.time = parseDecimal(p);
+            
+            while (is_space(*p)) ++p;
+            record.source = parseDecimal(p);
+        }
+        
+        begin = std::min((size_t)(eol - buffer) + 1, end);
+        parseBytes += buffer + begin - line;
+    }
+    
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    parseTime += elapsed(start, stop);
+    
+    return count > 0;
+}
+
+const Record *TextReader::next()
+{
+    if (cursor == count && !parse()) return NULL;
+    
+    position += 1;
+    return &records[cursor++];
+}
+
+
+
+BinaryReader::BinaryReader(void *_base, size_t _length) :
+    base(_base),
+    length(_length)
+{
+    const Header *header = (const Header *)base;
+    
+    cursor = (const Record *)(header+1);
+    end    = cursor + header->count;
+}
+
+BinaryReader::~BinaryReader()
+{
+    munmap(base, length);
+}
+
+const Record *BinaryReader::next()
+{
+    if (cursor == end) return NULL;
+    
+    position += 1;
+    return cursor++;
+}
+
+bool BinaryReader::seek(uint64_t offset)
+{
+    const Record *begin = (const Record *)((const Header *)base + 1);
+    if (offset > (uint64_t)(end - begin)) return false;
+    
+    cursor   = begin + offset;
+    position = offset;
+    
+    return true;
+}
+
+
+
+MemoryReader::MemoryReader(const Record *_begin, const Record *_end) :
+    begin(_begin),
+    cursor(_begin),
+    end(_end)
+{
+}
+
+const Record *MemoryReader::next()
+{
+    if (cursor == end) return NULL;
+    
+    position += 1;
+    return cursor++;
+}
+
+bool MemoryReader::seek(uint64_t offset)
+{
+    if (offset > (uint64_t)(end - begin)) return false;
+    
+    cursor   = begin + offset;
+    position = offset;
+    
+    return true;
+}
+
+
+
+Writer::Writer(FILE *_file) :
+    file(_file)
+{
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version    = version;
+    header.recordSize = sizeof(Record);
+    header.count      = 0;
+    
+    fwrite(&header, sizeof(header), 1, file);
+}
+
+Writer::~Writer()
+{
+    if (file != NULL) close();
+}
+
+Writer *Writer::open(const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) return NULL;
+    
+    return new Writer(file);
+}
+
+bool Writer::write(const Record &record)
+{
+    Record padded = record;
+    memset(padded.reserved, 0, sizeof(padded.reserved));
+    
+    if (fwrite(&padded, sizeof(padded), 1, file) != 1) return false;
+    header.count += 1;
+    
+    return true;
+}
+
+bool Writer::close()
+{
+    // the count is only known at the end
+    bool ok = fseek(file, 0, SEEK_SET) == 0 &&
+        fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = fclose(file) == 0 && ok;
+    file = NULL;
+    
+    return ok;
+}
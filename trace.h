@@ -0,0 +1,152 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "configure.h"
+#include <cstdio>
+
+namespace Trace {
+
+/** Record flags */
+enum RecordFlag {
+    FLAG_write = 1 << 0, /**< write request, read otherwise */
+};
+
+/** Fixed-width record of a binary trace. */
+struct Record {
+    uint64_t address;
+    uint64_t time;
+    uint8_t flags;
+    uint8_t reserved[5]; /**< zero, keeps records 8-byte aligned */
+    uint16_t source; /**< core or thread issuing the request, 0 if unknown */
+    
+    bool is_write() const { return flags & FLAG_write; }
+};
+
+/** Header at the start of a binary trace, followed by count records. */
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t count;
+};
+
+extern const char magic[8];
+static const uint32_t version = 1;
+
+/** Sequential trace reader. */
+class Reader
+{
+protected:
+    uint64_t parseBytes; /**< Text parsed so far. */
+    double parseTime; /**< Seconds spent parsing it, not reading it. */
+    uint64_t position; /**< Records handed out so far. */
+
+public:
+    Reader() : parseBytes(0), parseTime(0), position(0) {}
+    virtual ~Reader() {}
+    
+    /** Next record, or NULL at the end of the trace.
+     *  The record stays valid until the next call. */
+    virtual const Record *next() = 0;
+    
+    /** Records handed out so far, the offset of the next one. */
+    uint64_t tell() { return position; }
+    /** Continue from the record at offset, by reading up to it; false if
+     *  the trace is shorter, or offset is behind. */
+    virtual bool seek(uint64_t offset);
+    
+    /** Text parse rate in MB/s, 0 if nothing was parsed. */
+    double getParseRate() {
+        return parseTime > 0 ? parseBytes/parseTime/1e6 : 0;
+    }
+    
+    /** Open a binary or text trace, as told by its header; NULL on error. */
+    static Reader *open(const char *path);
+};
+
+/** Reader of "0x<address> <command> <time> [source]" lines.
+ *  The text is read in large chunks, each parsed into a batch of records. */
+class TextReader : public Reader
+{
+protected:
+    static const size_t chunkSize = 1 << 20;
+    static const size_t batchSize = 1 << 14;
+    
+    FILE *file;
+    bool eof;
+    
+    char *buffer; /**< chunkSize bytes of text, padded for vector loads */
+    size_t begin; /**< first byte not parsed yet */
+    size_t end; /**< last byte read plus one */
+    
+    Record *records;
+    size_t count;
+    size_t cursor;
+    
+    bool parse();
+
+public:
+    TextReader(FILE *_file);
+    virtual ~TextReader();
+    
+    const Record *next();
+};
+
+/** Reader of a memory-mapped binary trace, handing out records in place. */
+class BinaryReader : public Reader
+{
+protected:
+    void *base;
+    size_t length;
+    
+    const Record *cursor;
+    const Record *end;
+
+public:
+    BinaryReader(void *_base, size_t _length);
+    virtual ~BinaryReader();
+    
+    const Record *next();
+    /** Continue from the record at offset, either way and right away. */
+    bool seek(uint64_t offset);
+};
+
+/** Reader of records already in memory, which it does not own, so that
+ *  any number of readers can share one loaded trace. */
+class MemoryReader : public Reader
+{
+protected:
+    const Record *begin;
+    const Record *cursor;
+    const Record *end;
+
+public:
+    MemoryReader(const Record *_begin, const Record *_end);
+    
+    const Record *next();
+    /** Continue from the record at offset, either way and right away. */
+    bool seek(uint64_t offset);
+};
+
+/** Writer of binary traces. */
+class Writer
+{
+protected:
+    FILE *file;
+    Header header;
+
+public:
+    Writer(FILE *_file);
+    virtual ~Writer();
+    
+    /** Open a binary trace for writing; NULL on error. */
+    static Writer *open(const char *path);
+    
+    bool write(const Record &record);
+    /** Complete the header; false if the trace could not be written. */
+    bool close();
+};
+
+};
+
+#endif
@@ -0,0 +1,47 @@
+#include "trace.h"
+#include <cstdio>
+
+using namespace Trace;
+
+/** Convert a text trace into a binary one. */
+int main(int argc, char *argv[])
+{
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s input output\n", argv[0]);
+        return 1;
+    }
+    
+    Reader *reader = Reader::open(argv[1]);
+    if (reader == NULL) {
+        fprintf(stderr, "%s: cannot read trace %s\n", argv[0], argv[1]);
+        return 1;
+    }
+    
+    Writer *writer = Writer::open(argv[2]);
+    if (writer == NULL) {
+        fprintf(stderr, "%s: cannot write trace %s\n", argv[0], argv[2]);
+        delete reader;
+        return 1;
+    }
+    
+    bool ok = true;
+    const Record *record;
+    while (ok && (record = reader->next())) {
+        ok = writer->write(*record);
+    }
+    ok = writer->close() && ok;
+    
+    if (reader->getParseRate() > 0) {
+        fprintf(stderr, "parse_rate: %.1f MB/s\n", reader->getParseRate());
+    }
+    
+    delete writer;
+    delete reader;
+    
+    if (!ok) {
+        fprintf(stderr, "%s: cannot write trace %s\n", argv[0], argv[2]);
+        return 1;
+    }
+    
+    return 0;
+}
@@ -0,0 +1,65 @@
+#include "shm.h"
+#include <cstdio>
+#include <cstdlib>
+#include <sched.h>
+
+using namespace Trace;
+
+/** Replay a trace into shared memory for "component -s", as a producer
+ *  would, and report the completed requests coming back. */
+int main(int argc, char *argv[])
+{
+    if (argc < 3 || argc > 4) {
+        fprintf(stderr, "usage: %s trace name [slots]\n", argv[0]);
+        return 1;
+    }
+    
+    Reader *reader = Reader::open(argv[1]);
+    if (reader == NULL) {
+        fprintf(stderr, "%s: cannot read trace %s\n", argv[0], argv[1]);
+        return 1;
+    }
+    
+    size_t slots = argc > 3 ? strtoul(argv[3], NULL, 10) : 1 << 12;
+    SharedMemory *shared = SharedMemory::create(argv[2], slots);
+    if (shared == NULL) {
+        fprintf(stderr, "%s: cannot create shared memory %s\n", argv[0], argv[2]);
+        delete reader;
+        return 1;
+    }
+    
+    uint64_t pushed = 0, completed = 0;
+    int64_t latency = 0;
+    Memory::Completion completion;
+    
+    // keep completions flowing while waiting for the simulator
+    const Record *record = reader->next();
+    while (record || completed < pushed) {
+        bool stopped = shared->is_stopped();
+        
+        if (record && shared->push(*record)) {
+            // the trace is in time order, so nothing comes before this record
+            shared->setHorizon(record->time);
+            pushed += 1;
+            if (!(record = reader->next())) shared->close();
+        } else if (shared->poll(completion)) {
+            completed += 1;
+            latency += completion.releaseTime - completion.allocateTime;
+        } else if (stopped) {
+            // the simulator ended before the trace did
+            break;
+        } else {
+            sched_yield();
+        }
+    }
+    if (pushed == 0) shared->close();
+    
+    printf("pushed: %lu\n", (unsigned long)pushed);
+    printf("completed: %lu\n", (unsigned long)completed);
+    printf("latency: %.3f\n", completed ? (double)latency/completed : 0.0);
+    
+    delete shared;
+    delete reader;
+    
+    return 0;
+}